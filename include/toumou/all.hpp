@@ -1,16 +1,25 @@
 #pragma once
 
+#include <toumou/baking.hpp>
+#include <toumou/bvh.hpp>
 #include <toumou/camera.hpp>
 #include <toumou/color.hpp>
 #include <toumou/constants.hpp>
 #include <toumou/denoising.hpp>
+#include <toumou/dispatch.hpp>
+#include <toumou/field.hpp>
+#include <toumou/field_compilation.hpp>
 #include <toumou/geometry.hpp>
 #include <toumou/image.hpp>
 #include <toumou/io.hpp>
 #include <toumou/light.hpp>
 #include <toumou/macros.hpp>
 #include <toumou/material.hpp>
+#include <toumou/occupancy.hpp>
 #include <toumou/rendering.hpp>
 #include <toumou/root_estimation.hpp>
+#include <toumou/sampling.hpp>
 #include <toumou/scene.hpp>
+#include <toumou/scene_arrays.hpp>
+#include <toumou/scheduling.hpp>
 #include <toumou/surface.hpp>
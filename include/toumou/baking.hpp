@@ -0,0 +1,130 @@
+#pragma once
+
+#include <toumou/field.hpp>
+#include <toumou/geometry.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace toumou {
+
+/**
+ * @brief Field sampled on a sparse grid and interpolated trilinearly.
+ *
+ * The grid is split into blocks of block_cells^3 voxels. Only the blocks in which the field crosses
+ * the baking level (and their neighbours) store their samples, the other blocks are reduced to
+ * the range of values of their samples and evaluate to the middle of that range.
+ * Outside of the baked box, the value at the closest point of the box is returned.
+ *
+ * Baked fields can be saved to disk and loaded back by later renders,
+ * in which case the samples are memory-mapped from the file instead of being read.
+ */
+class BakedField : public Field {
+public:
+
+	/// Number of voxels along each side of a block.
+	static const int block_cells = 8;
+
+	/// Number of samples along each side of a block (samples on the blocks' faces are duplicated).
+	static const int block_nodes = block_cells + 1;
+
+	/**
+	 * @brief Bake a field inside a box.
+	 * @param[in] field Field to bake.
+	 * @param[in] box Region in which the field is sampled.
+	 * @param[in] voxel_size Distance between two consecutive samples.
+	 * @param[in] level Level near which the samples are stored.
+	 * @param[in] n_threads Number of baking threads (0 means one thread per hardware thread).
+	 */
+	BakedField(std::shared_ptr<Field> field, const Box3& box, float voxel_size, float level = 1.f, int n_threads = 0);
+
+	/**
+	 * @brief Load a field saved with save.
+	 * @param[in] path Filepath of the baked field.
+	 */
+	BakedField(const std::string& path);
+
+	/**
+	 * @brief Write the baked field on disk.
+	 * @param[in] path Filepath to save the baked field to.
+	 */
+	void save(const std::string& path) const;
+
+	/// Number of blocks storing their samples.
+	int n_dense_blocks() const;
+
+	float value(const Vec3& pos) const override;
+
+	/// Gradient of the trilinear interpolation.
+	Vec3 gradient(const Vec3& pos) const override;
+
+	float ray_derivative(const Ray& ray, float t) const override;
+
+	Dual value_and_gradient(const Vec3& pos) const override;
+
+	float value_and_ray_derivative(const Ray& ray, float t, float& derivative) const override;
+
+	/// Union of the blocks whose samples reach the level, only bounded if no block on the grid's border does.
+	Box3 superlevel_bounds(float level) const override;
+
+	/// Union of the blocks whose samples go down to the level, only bounded if no block on the grid's border does.
+	Box3 sublevel_bounds(float level) const override;
+
+	/// Union of the ranges of the blocks covering the box.
+	Interval range(const Box3& box) const override;
+
+private:
+
+	/// Position of the first sample.
+	Vec3 m_origin;
+
+	/// Distance between two consecutive samples.
+	float m_voxel_size;
+
+	/// Level near which the samples are stored.
+	float m_level;
+
+	/// Number of blocks along each axis.
+	int m_n_blocks[3];
+
+	/// Index of each block's samples, -1 for blocks reduced to their range.
+	std::vector<std::int32_t> m_offsets;
+
+	/// Minimum sample value of each block.
+	std::vector<float> m_min;
+
+	/// Maximum sample value of each block.
+	std::vector<float> m_max;
+
+	/// Samples of the dense blocks, block after block, owned by the field when it was baked.
+	std::vector<float> m_samples;
+
+	/// Memory-mapped file holding the samples, when the field was loaded.
+	std::shared_ptr<const void> m_mapping;
+
+	/// Position of the samples in the mapped file, in bytes (kept as an offset so that copies share the mapping safely).
+	std::size_t m_mapping_offset;
+
+	/// Samples of the dense blocks (either m_samples or a part of the mapped file).
+	const float* samples() const;
+
+	/// Total number of blocks.
+	int n_blocks() const;
+
+	/// Box covered by a block.
+	Box3 block_box(int bi, int bj, int bk) const;
+
+	/// Union of the blocks selected by a predicate on their range, infinite if a border block is selected.
+	template<typename Predicate>
+	Box3 blocks_bounds(Predicate predicate) const;
+
+	/// Evaluate the trilinear interpolation and its gradient.
+	Dual interpolate(const Vec3& pos) const;
+
+};
+
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <toumou/geometry.hpp>
+#include <toumou/scene.hpp>
+#include <toumou/surface.hpp>
+
+#include <memory>
+#include <vector>
+
+
+namespace toumou {
+
+/**
+ * @brief Surface hit by a neighbouring ray and distance of the hit, from which coherent rays start their search.
+ */
+struct HitHint {
+
+	/// Surface hit by the neighbouring ray, null if there is none.
+	const Surface* surface = nullptr;
+
+	/// Distance between the neighbouring ray's origin and its hit.
+	float t = 0.f;
+
+};
+
+/**
+ * @brief Description of a ray's closest hit, referencing the surface and its material without owning them.
+ * 
+ * The referenced objects belong to the committed scene the hit was found in, and stay valid as long as it exists.
+ */
+struct HitRecord {
+
+	/// Index of the surface in the committed scene, -1 if there is no hit.
+	int index = -1;
+
+	/// Surface hit by the ray.
+	const Surface* surface = nullptr;
+
+	/// Material of the surface hit by the ray.
+	const Material* material = nullptr;
+
+	/// Distance between the ray's origin and the hit.
+	float t = 0.f;
+
+	/// Hit position.
+	Vec3 position;
+
+	/// Surface normal at the hit, only computed for the closest hit.
+	Vec3 normal;
+
+	/// Radius of the ray's footprint at the hit.
+	float footprint = 0.f;
+
+};
+
+/**
+ * @brief Bounding volume hierarchy over the surfaces of a committed scene.
+ * 
+ * Bounded surfaces are stored in a binary tree of axis-aligned bounding boxes, 
+ * so that rays only test the surfaces whose boxes they cross.
+ * Planes and tubes are always tested, in one loop per type over the scene's arrays,
+ * and the other unbounded surfaces are kept in a separate list which is always tested.
+ * Surfaces are tested according to their type in the committed scene, without virtual calls for the known types.
+ */
+class BVH {
+public:
+
+	/**
+	 * @brief Build the hierarchy, or only refit its boxes if the surfaces are the same as for the previous build.
+	 * @param[in] scene Committed scene whose surfaces are stored in the hierarchy, it must outlive the hierarchy's queries.
+	 */
+	void update(const CommittedScene& scene);
+
+	/**
+	 * @brief Find the first surface hit by a given ray.
+	 * @param[in] ray Ray to check for intersection.
+	 * @param[out] record Description of the closest hit (if a hit has been found).
+	 * @param[in] hint Hit of a neighbouring ray, the hinted surface is searched near the hinted distance.
+	 * @return Whether or not a surface was hit.
+	 */
+	bool hit(const Ray& ray, HitRecord& record, const HitHint& hint = HitHint()) const;
+
+	/**
+	 * @brief Find the first surface hit by each ray of a packet.
+	 * 
+	 * Spheres, planes and tubes are tested against all the rays at once. Implicit surfaces and surfaces of other types
+	 * met during the traversal are tested afterwards, one ray at a time in the packet's order.
+	 * @param[in] packet Rays to check for intersection.
+	 * @param[out] records Description of the closest hit of each ray (index is -1 for the rays without hit).
+	 * @param[in,out] hints Hint of each lane (ignored if null, or for the null lanes): a ray starts from the hit of a neighbouring ray 
+	 * and replaces it with its own hit, so that the later lanes sharing the same hint start from it.
+	 */
+	void hit(const RayPacket& packet, HitRecord* records, HitHint* const* hints = nullptr) const;
+
+	/**
+	 * @brief Check if any surface blocks a given ray before a given distance.
+	 * @param[in] ray Ray to check for occlusion.
+	 * @param[in] t_max Distance from the ray's origin beyond which intersections are ignored.
+	 * @return Whether or not the ray is blocked before t_max.
+	 */
+	bool occluded(const Ray& ray, float t_max) const;
+
+private:
+
+	/// Tree node, leaves reference a range of bounded surfaces and inner nodes their two children.
+	struct Node {
+
+		/// Box enclosing all the surfaces below this node.
+		Box3 box;
+
+		/// Index of the first surface (leaf) or of the left child, the right child follows it (inner node).
+		int first;
+
+		/// Number of surfaces in the leaf, 0 for inner nodes.
+		int count;
+
+	};
+
+	/// Maximum number of surfaces in a leaf.
+	static const int max_leaf_size = 2;
+
+	/// Committed scene given at the last update.
+	const CommittedScene* m_scene = nullptr;
+
+	/// Surfaces given at the last build, in their original order.
+	std::vector<std::shared_ptr<Surface>> m_input;
+
+	/// Indices of the bounded surfaces, ordered so that each leaf references a contiguous range.
+	std::vector<int> m_bounded;
+
+	/// Bounding boxes of the bounded surfaces (same order).
+	std::vector<Box3> m_boxes;
+
+	/// Indices of the unbounded surfaces that are neither planes nor tubes.
+	std::vector<int> m_unbounded;
+
+	/// Tree nodes, the root is the first one.
+	std::vector<Node> m_nodes;
+
+	/// Build the whole hierarchy from scratch.
+	void build();
+
+	/// Recursively build the subtree rooted at a given node for the bounded surfaces in [begin, end).
+	void build_node(int index, int begin, int end);
+
+	/// Recompute the boxes of the hierarchy without changing its structure.
+	void refit();
+
+	/// Bounding box of a surface of the committed scene.
+	Box3 bounds(int surface) const;
+
+	/// Check if a ray intersects a surface of the committed scene, the normal is only computed by implicit surfaces and surfaces of other types.
+	bool hit(int surface, const Ray& ray, const HitHint& hint, float& t, Vec3& normal) const;
+
+	/// Fill the record of a ray's closest hit, the normal is only used for implicit surfaces and surfaces of other types.
+	void record_hit(int surface, const Ray& ray, float t, const Vec3& normal, HitRecord& record) const;
+
+	/// Check if a surface of the committed scene blocks a ray before a given distance.
+	bool occluded(int surface, const Ray& ray, float t_max) const;
+
+	/// Normal of a sphere, plane or tube of the committed scene at a given hit.
+	Vec3 normal(int surface, const Vec3& pos) const;
+
+};
+
+}
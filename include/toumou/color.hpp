@@ -19,4 +19,11 @@ inline const Color MAGENTA = Color(1, 0, 1);
 inline const Color CYAN = Color(0, 1, 1);
 inline const Color WHITE = Color(1, 1, 1);
 
+/**
+ * @brief Compute the intensity of a color, as the mean of its channels.
+ * @param[in] color Color whose intensity is computed.
+ * @return Color intensity.
+ */
+float intensity(const Color& color); // TODO: use luma formula instead
+
 }
@@ -0,0 +1,54 @@
+#pragma once
+
+
+/**
+ * @brief Attribute compiling a hot kernel once per instruction set, the dynamic loader selecting the best variant for the CPU.
+ * 
+ * Variants are only generated with GCC and Clang on x86 ELF platforms (the attribute relies on indirect functions), 
+ * kernels are compiled once for the baseline elsewhere. The library is built without floating-point contraction 
+ * so that all the variants compute bit-identical results.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__ELF__) && (!defined(__clang__) || __clang_major__ >= 14)
+#define TOUMOU_DISPATCH_VARIANTS 1
+#define TOUMOU_DISPATCH __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default")))
+#else
+#define TOUMOU_DISPATCH_VARIANTS 0
+#define TOUMOU_DISPATCH
+#endif
+
+
+namespace toumou {
+
+/**
+ * @brief Instruction sets for which the hot kernels are compiled.
+ */
+enum class InstructionSet {
+
+	/// Target of the build (no variants).
+	Baseline,
+
+	/// SSE 4.2.
+	SSE4,
+
+	/// AVX2.
+	AVX2,
+
+	/// AVX-512 (foundation).
+	AVX512
+
+};
+
+/**
+ * @brief Get the instruction set of the kernel variants selected for the current CPU.
+ * @return Instruction set of the selected variants, Baseline if the kernels only have one variant.
+ */
+InstructionSet dispatched_instruction_set();
+
+/**
+ * @brief Get the name of an instruction set.
+ * @param[in] instruction_set Instruction set.
+ * @return Name of the instruction set.
+ */
+const char* instruction_set_name(InstructionSet instruction_set);
+
+}
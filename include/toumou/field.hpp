@@ -2,6 +2,8 @@
 
 #include <toumou/geometry.hpp>
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <unordered_map>
 #include <vector>
@@ -9,6 +11,21 @@
 
 namespace toumou {
 
+class FieldCompiler;
+
+/**
+ * @brief Field value along with its gradient, computed together by forward-mode automatic differentiation.
+ */
+struct Dual {
+
+	/// Field value.
+	float value = 0.f;
+
+	/// Field gradient.
+	Vec3 gradient = Vec3(0.f);
+
+};
+
 /**
  * @brief TODO
  */
@@ -25,6 +42,19 @@ public:
 	 */
 	virtual float value(const Vec3& pos) const = 0;
 
+	/**
+	 * @brief Evaluate the field at several positions at once.
+	 * 
+	 * Positions are given as separate coordinate arrays (structure of arrays) so that implementations 
+	 * can process several positions per instruction. By default value is called for each position.
+	 * @param[in] xs X coordinates of the positions.
+	 * @param[in] ys Y coordinates of the positions.
+	 * @param[in] zs Z coordinates of the positions.
+	 * @param[out] out Field values (must not overlap with the coordinates).
+	 * @param[in] n Number of positions.
+	 */
+	virtual void value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const;
+
 	/**
 	 * @brief TODO
 	 */
@@ -35,6 +65,77 @@ public:
 	 */
 	virtual float ray_derivative(const Ray& ray, float t) const;
 
+	/**
+	 * @brief Evaluate the field and its gradient in a single traversal of the field graph.
+	 * 
+	 * By default the value and the gradient are evaluated separately.
+	 * @param[in] pos Position at which to evaluate the field.
+	 * @return Field value and gradient.
+	 */
+	virtual Dual value_and_gradient(const Vec3& pos) const;
+
+	/**
+	 * @brief Evaluate the field and its derivative along a ray in a single traversal of the field graph.
+	 * 
+	 * By default the value and the derivative are evaluated separately.
+	 * @param[in] ray Ray along which the field is differentiated.
+	 * @param[in] t Distance between the ray's origin and the position at which to evaluate the field.
+	 * @param[out] derivative Derivative of the field along the ray.
+	 * @return Field value.
+	 */
+	virtual float value_and_ray_derivative(const Ray& ray, float t, float& derivative) const;
+
+	/**
+	 * @brief Compute a box enclosing all the points at which the field is greater than or equal to a given level.
+	 * @param[in] level Field level.
+	 * @return Enclosing box, infinite if the region is unbounded or if no bound is known.
+	 */
+	virtual Box3 superlevel_bounds(float level) const;
+
+	/**
+	 * @brief Compute a box enclosing all the points at which the field is lower than or equal to a given level.
+	 * @param[in] level Field level.
+	 * @return Enclosing box, infinite if the region is unbounded or if no bound is known.
+	 */
+	virtual Box3 sublevel_bounds(float level) const;
+
+	/**
+	 * @brief Compute an upper bound of the field's gradient norm inside a ball (local Lipschitz constant).
+	 * @param[in] center Center of the ball.
+	 * @param[in] radius Radius of the ball.
+	 * @return Lipschitz bound of the field inside the ball, infinity if no bound is known.
+	 */
+	virtual float lipschitz(const Vec3& center, float radius) const;
+
+	/**
+	 * @brief Compute an interval containing all the values taken by the field inside a box (interval arithmetic).
+	 * 
+	 * The default implementation bounds the field's variation around the box's center with its Lipschitz bound.
+	 * @param[in] box Box in which the field is evaluated (not empty).
+	 * @return Conservative range of the field inside the box, infinite if no bound is known.
+	 */
+	virtual Interval range(const Box3& box) const;
+
+	/**
+	 * @brief Shrink a box to the parts of it in which the field may reach a given level.
+	 * 
+	 * The box is subdivided as an octree, the cells whose range stays below the level are discarded.
+	 * @param[in] level Field level.
+	 * @param[in] box Box to shrink.
+	 * @param[in] depth Number of subdivisions of the box.
+	 * @return Union of the remaining cells, empty if the field stays below the level in the whole box.
+	 */
+	Box3 refine_superlevel_bounds(float level, const Box3& box, int depth) const;
+
+	/**
+	 * @brief Append the instructions evaluating this field to a program being compiled.
+	 * 
+	 * By default the field is evaluated through a virtual call to value.
+	 * @param[in] compiler Program being compiled.
+	 * @return Register holding the field's value.
+	 */
+	virtual int emit(FieldCompiler& compiler) const;
+
 };
 
 /**
@@ -53,6 +154,8 @@ public:
 	 */
 	float value(const Vec3& pos) const override;
 
+	void value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const override;
+
 	/**
 	 * @brief TODO
 	 */
@@ -63,6 +166,20 @@ public:
 	 */
 	float ray_derivative(const Ray& ray, float t) const override;
 
+	Dual value_and_gradient(const Vec3& pos) const override;
+
+	float value_and_ray_derivative(const Ray& ray, float t, float& derivative) const override;
+
+	Box3 superlevel_bounds(float level) const override;
+
+	Box3 sublevel_bounds(float level) const override;
+
+	float lipschitz(const Vec3& center, float radius) const override;
+
+	Interval range(const Box3& box) const override;
+
+	int emit(FieldCompiler& compiler) const override;
+
 private:
 
 	/// TODO
@@ -88,10 +205,26 @@ public:
 
 	float value(const Vec3& pos) const override;
 
+	void value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const override;
+
 	Vec3 gradient(const Vec3& pos) const override;
 
 	float ray_derivative(const Ray& ray, float t) const override;
 
+	Dual value_and_gradient(const Vec3& pos) const override;
+
+	float value_and_ray_derivative(const Ray& ray, float t, float& derivative) const override;
+
+	/// Only bounded for positive coefficients and non-negative fields.
+	Box3 superlevel_bounds(float level) const override;
+
+	float lipschitz(const Vec3& center, float radius) const override;
+
+	/// Sum of the terms' ranges scaled by their coefficients.
+	Interval range(const Box3& box) const override;
+
+	int emit(FieldCompiler& compiler) const override;
+
 private:
 
 	/// TODO
@@ -99,6 +232,114 @@ private:
 
 };
 
+/**
+ * @brief Sum of many fields with local influence, such as metaballs.
+ * 
+ * Each term has a box outside which its contribution is neglected: either its superlevel bounds 
+ * at the fusion's cutoff, or a box given by the user. The terms are indexed by a sparse grid of cubic cells, 
+ * so that evaluating the fusion at a point only visits the terms whose boxes overlap the point's cell.
+ * Terms without bounded influence are evaluated everywhere.
+ * Neglecting the terms outside of their boxes makes the sum discontinuous by at most the cutoff at the boxes' borders.
+ */
+class GridFusion : public Field {
+public:
+
+	/**
+	 * @brief Create an empty fusion.
+	 * @param[in] cell_size Size of the grid cells, of the order of the terms' radius of influence.
+	 * @param[in] cutoff Contributions below this value are neglected when computing the terms' boxes.
+	 */
+	GridFusion(float cell_size, float cutoff = 1e-3f);
+
+	/**
+	 * @brief Add a term whose box of influence is computed from its superlevel bounds.
+	 * 
+	 * Only non-negative fields with a positive coefficient can be bounded.
+	 * @param[in] field Field to add.
+	 * @param[in] coef Coefficient applied to the field.
+	 */
+	void add(std::shared_ptr<Field> field, float coef = 1.f);
+
+	/**
+	 * @brief Add a term with a given box of influence.
+	 * @param[in] field Field to add.
+	 * @param[in] coef Coefficient applied to the field.
+	 * @param[in] support Box outside which the term is neglected.
+	 */
+	void add(std::shared_ptr<Field> field, float coef, const Box3& support);
+
+	/// Number of terms.
+	int size() const;
+
+	float value(const Vec3& pos) const override;
+
+	Vec3 gradient(const Vec3& pos) const override;
+
+	float ray_derivative(const Ray& ray, float t) const override;
+
+	Dual value_and_gradient(const Vec3& pos) const override;
+
+	float value_and_ray_derivative(const Ray& ray, float t, float& derivative) const override;
+
+	/// Union of the terms' boxes, only bounded if all the boxes are.
+	Box3 superlevel_bounds(float level) const override;
+
+	float lipschitz(const Vec3& center, float radius) const override;
+
+	/// Sum of the ranges of the terms whose box of influence overlaps the box.
+	Interval range(const Box3& box) const override;
+
+private:
+
+	/// Single term of the sum.
+	struct Term {
+
+		/// Field.
+		std::shared_ptr<Field> field;
+
+		/// Coefficient.
+		float coef;
+
+		/// Box outside which the term is neglected.
+		Box3 support;
+
+		/// Whether the term is evaluated everywhere instead of being stored in the grid's cells.
+		bool global;
+
+	};
+
+	/// Maximum number of cells covered by a term, larger terms are evaluated everywhere.
+	static const int max_term_cells = 4096;
+
+	/// Size of the grid cells.
+	float m_cell_size;
+
+	/// Contribution below which terms are neglected.
+	float m_cutoff;
+
+	/// All terms.
+	std::vector<Term> m_terms;
+
+	/// Indices of the terms evaluated everywhere.
+	std::vector<int> m_global;
+
+	/// Indices of the terms overlapping each non-empty cell.
+	std::unordered_map<std::int64_t, std::vector<int>> m_cells;
+
+	/// Integer coordinates of the cell containing a given position.
+	void cell_of(const Vec3& pos, int& i, int& j, int& k) const;
+
+	/// Indices of the terms stored in the cells covered by a box, all the terms if the box covers too many cells.
+	std::vector<int> terms_in(const Box3& box) const;
+
+	/// Key of a cell in the grid.
+	static std::int64_t cell_key(int i, int j, int k);
+
+	/// Terms overlapping the cell of a given position, null if there are none.
+	const std::vector<int>* terms_at(const Vec3& pos) const;
+
+};
+
 /**
  * @brief TODO
  */
@@ -115,10 +356,25 @@ public:
 
 	float value(const Vec3& pos) const override;
 
+	void value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const override;
+
 	Vec3 gradient(const Vec3& pos) const override;
 
 	float ray_derivative(const Ray& ray, float t) const override;
 
+	Dual value_and_gradient(const Vec3& pos) const override;
+
+	float value_and_ray_derivative(const Ray& ray, float t, float& derivative) const override;
+
+	Box3 sublevel_bounds(float level) const override;
+
+	float lipschitz(const Vec3& center, float radius) const override;
+
+	/// Squared distances to the closest and farthest points of the box.
+	Interval range(const Box3& box) const override;
+
+	int emit(FieldCompiler& compiler) const override;
+
 };
 
 /**
@@ -140,10 +396,25 @@ public:
 
 	float value(const Vec3& pos) const override;
 
+	void value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const override;
+
 	Vec3 gradient(const Vec3& pos) const override;
 
 	float ray_derivative(const Ray& ray, float t) const override;
 
+	Dual value_and_gradient(const Vec3& pos) const override;
+
+	float value_and_ray_derivative(const Ray& ray, float t, float& derivative) const override;
+
+	Box3 sublevel_bounds(float level) const override;
+
+	float lipschitz(const Vec3& center, float radius) const override;
+
+	/// Bounded by the range of the offset to the line along each axis, and by the box's corners from above.
+	Interval range(const Box3& box) const override;
+
+	int emit(FieldCompiler& compiler) const override;
+
 };
 
 /**
@@ -165,10 +436,23 @@ public:
 
 	float value(const Vec3& pos) const override;
 
+	void value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const override;
+
 	Vec3 gradient(const Vec3& pos) const override;
 
 	float ray_derivative(const Ray& ray, float t) const override;
 
+	Dual value_and_gradient(const Vec3& pos) const override;
+
+	float value_and_ray_derivative(const Ray& ray, float t, float& derivative) const override;
+
+	float lipschitz(const Vec3& center, float radius) const override;
+
+	/// Signed distances of the box's extreme corners along the normal.
+	Interval range(const Box3& box) const override;
+
+	int emit(FieldCompiler& compiler) const override;
+
 };
 
 /**
@@ -190,17 +474,51 @@ public:
 	 */
 	virtual float remap(float t) const = 0;
 
+	/**
+	 * @brief Remap several values at once, in place.
+	 * @param[in,out] ts Values to remap.
+	 * @param[in] n Number of values.
+	 */
+	virtual void remap_batch(float* ts, std::size_t n) const;
+
 	/**
 	 * @brief TODO
 	 */
 	virtual float derivative(float t) const;
 
+	/**
+	 * @brief Compute an upper bound of the remapping's slope on an input interval.
+	 * @param[in] t_min Lower end of the input interval.
+	 * @param[in] t_max Upper end of the input interval.
+	 * @return Maximum absolute slope of the remapping on the interval, infinity if no bound is known.
+	 */
+	virtual float slope_bound(float t_min, float t_max) const;
+
+	/**
+	 * @brief Compute the range of the remapping on an input interval.
+	 * @param[in] t Input interval.
+	 * @return Interval containing the remapped values, infinite if no bound is known.
+	 */
+	virtual Interval remap_range(const Interval& t) const;
+
 	float value(const Vec3& pos) const override;
 
+	void value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const override;
+
 	Vec3 gradient(const Vec3& pos) const override;
 
 	float ray_derivative(const Ray& ray, float t) const override;
 
+	Dual value_and_gradient(const Vec3& pos) const override;
+
+	float value_and_ray_derivative(const Ray& ray, float t, float& derivative) const override;
+
+	/// Chain rule applied to the input field's bound and to the remapping's slope on the input field's local range.
+	float lipschitz(const Vec3& center, float radius) const override;
+
+	/// Remapped range of the input field.
+	Interval range(const Box3& box) const override;
+
 };
 
 /**
@@ -219,8 +537,20 @@ public:
 
 	float remap(float t) const override;
 
+	void remap_batch(float* ts, std::size_t n) const override;
+
 	float derivative(float t) const;
 
+	Box3 superlevel_bounds(float level) const override;
+
+	Box3 sublevel_bounds(float level) const override;
+
+	float slope_bound(float t_min, float t_max) const override;
+
+	Interval remap_range(const Interval& t) const override;
+
+	int emit(FieldCompiler& compiler) const override;
+
 };
 
 /**
@@ -239,8 +569,20 @@ public:
 
 	float remap(float t) const override;
 
+	void remap_batch(float* ts, std::size_t n) const override;
+
 	float derivative(float t) const;
 
+	Box3 superlevel_bounds(float level) const override;
+
+	Box3 sublevel_bounds(float level) const override;
+
+	float slope_bound(float t_min, float t_max) const override;
+
+	Interval remap_range(const Interval& t) const override;
+
+	int emit(FieldCompiler& compiler) const override;
+
 };
 
 /**
@@ -256,8 +598,20 @@ public:
 
 	float remap(float t) const override;
 
+	void remap_batch(float* ts, std::size_t n) const override;
+
 	float derivative(float t) const;
 
+	Box3 superlevel_bounds(float level) const override;
+
+	Box3 sublevel_bounds(float level) const override;
+
+	float slope_bound(float t_min, float t_max) const override;
+
+	Interval remap_range(const Interval& t) const override;
+
+	int emit(FieldCompiler& compiler) const override;
+
 private:
 
 	/// TODO
@@ -281,6 +635,24 @@ public:
 
 	float value(const Vec3& pos) const override;
 
+	void value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const override;
+
+	/// Gradient of the distance to the closest point, whose direction is the one from that point.
+	Vec3 gradient(const Vec3& pos) const override;
+
+	float ray_derivative(const Ray& ray, float t) const override;
+
+	Dual value_and_gradient(const Vec3& pos) const override;
+
+	float value_and_ray_derivative(const Ray& ray, float t, float& derivative) const override;
+
+	Box3 sublevel_bounds(float level) const override;
+
+	float lipschitz(const Vec3& center, float radius) const override;
+
+	/// Distance to the closest point is non-negative and bounded around the box's center by the Lipschitz bound.
+	Interval range(const Box3& box) const override;
+
 private:
 
 	/// TODO
@@ -292,6 +664,9 @@ private:
 	/// TODO
 	std::vector<Vec3> m_points;
 
+	/// Find the point closest to a given position, returns the normalized distance to it.
+	float closest_point(const Vec3& pos, Vec3& point) const;
+
 };
 
 }
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <toumou/field.hpp>
+#include <toumou/geometry.hpp>
+
+#include <array>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+
+namespace toumou {
+
+/**
+ * @brief Operations available in a field program.
+ */
+enum class FieldOp {
+
+	/// Constant value: p[0].
+	Constant,
+
+	/// Squared distance to point (p[0], p[1], p[2]).
+	Dist2ToPoint,
+
+	/// Squared distance to line of origin (p[0], p[1], p[2]) and direction (p[3], p[4], p[5]).
+	Dist2ToLine,
+
+	/// Signed distance to plane of origin (p[0], p[1], p[2]) and normal (p[3], p[4], p[5]).
+	SignedDistToPlane,
+
+	/// r[a] * p[0] + p[1].
+	Affine,
+
+	/// r[a] + r[b] * p[0].
+	MulAdd,
+
+	/// p[0] + sum of r[k] * c for the b (k, c) pairs of the operand list starting at a.
+	Sum,
+
+	/// p[0] / max(eps, r[a]).
+	Inverse,
+
+	/// exp(r[a] * p[0]).
+	Exponential,
+
+	/// Cubic Hermite interpolation of r[a] between p[0] and p[1].
+	Smoothstep,
+
+	/// Inverse with radius p[3] of the squared distance to point (p[0], p[1], p[2]).
+	InverseDist2ToPoint,
+
+	/// Exponential with factor p[3] of the squared distance to point (p[0], p[1], p[2]).
+	ExponentialDist2ToPoint,
+
+	/// Virtual evaluation of a field that cannot be compiled.
+	Call
+
+};
+
+/**
+ * @brief Single instruction of a field program, its result is stored in the register of the same index.
+ */
+struct FieldInstruction {
+
+	/// Operation.
+	FieldOp op = FieldOp::Constant;
+
+	/// Register operands.
+	int a = -1, b = -1;
+
+	/// Constant operands.
+	std::array<float, 6> p = {};
+
+	/// Field evaluated by Call instructions.
+	const Field* field = nullptr;
+
+};
+
+/**
+ * @brief Field graph flattened into a linear sequence of instructions.
+ * 
+ * Programs are evaluated by a simple interpreter loop over the instructions, 
+ * which avoids the virtual calls and pointer chasing of the field graph.
+ * The same loop can propagate gradients along with values (dual numbers).
+ */
+class FieldProgram {
+public:
+
+	/// Create an empty program, which evaluates to zero.
+	FieldProgram();
+
+	/**
+	 * @brief Evaluate the compiled field at a given position.
+	 * @param[in] pos Position at which to evaluate the field.
+	 * @return Field value.
+	 */
+	float value(const Vec3& pos) const;
+
+	/**
+	 * @brief Evaluate the compiled field and its gradient in a single pass, using forward-mode automatic differentiation.
+	 * 
+	 * Fields evaluated through Call instructions provide their gradient with Field::value_and_gradient.
+	 * @param[in] pos Position at which to evaluate the field.
+	 * @return Field value and gradient.
+	 */
+	Dual value_and_gradient(const Vec3& pos) const;
+
+	/**
+	 * @brief Evaluate the compiled field at several positions at once.
+	 * 
+	 * Each instruction is applied to a chunk of positions before moving to the next one, 
+	 * so that the interpreter's dispatch cost is shared and the per-instruction loops can be vectorized.
+	 * @param[in] xs X coordinates of the positions.
+	 * @param[in] ys Y coordinates of the positions.
+	 * @param[in] zs Z coordinates of the positions.
+	 * @param[out] out Field values.
+	 * @param[in] n Number of positions.
+	 */
+	void value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const;
+
+	/// Check if the program was compiled from a given field.
+	bool compiled_from(const Field* field) const;
+
+	/// Number of instructions in the program.
+	int size() const;
+
+private:
+
+	friend class FieldCompiler;
+
+	/// Instructions, in evaluation order.
+	std::vector<FieldInstruction> m_instructions;
+
+	/// Operand lists of Sum instructions.
+	std::vector<std::pair<int, float>> m_operands;
+
+	/// Register holding the result.
+	int m_output;
+
+	/// Field the program was compiled from, kept alive for Call instructions.
+	std::shared_ptr<Field> m_source;
+
+};
+
+/**
+ * @brief Builder of field programs.
+ * 
+ * Fields append their instructions through Field::emit. 
+ * The compiler visits shared subfields only once, merges identical instructions (common subexpression elimination), 
+ * evaluates instructions whose operands are all constant at compile time (constant folding) 
+ * and fuses remappings of squared distances into single instructions.
+ */
+class FieldCompiler {
+public:
+
+	/**
+	 * @brief Append the instructions of a field, or retrieve them if the field was already compiled.
+	 * @param[in] field Field to compile.
+	 * @return Register holding the field's value.
+	 */
+	int compile(const Field& field);
+
+	/**
+	 * @brief Append an instruction.
+	 * @param[in] instruction Instruction to append.
+	 * @return Register holding the instruction's result.
+	 */
+	int push(const FieldInstruction& instruction);
+
+	/**
+	 * @brief Append a weighted sum.
+	 * @param[in] terms Registers to sum and their coefficients.
+	 * @param[in] offset Constant added to the sum.
+	 * @return Register holding the sum.
+	 */
+	int sum(const std::vector<std::pair<int, float>>& terms, float offset);
+
+	/**
+	 * @brief Append a constant.
+	 * @param[in] value Constant value.
+	 * @return Register holding the constant.
+	 */
+	int constant(float value);
+
+	/**
+	 * @brief Check if a register holds a constant known at compile time.
+	 * @param[in] reg Register to check.
+	 * @param[out] value Constant value (if the register is constant).
+	 * @return Whether or not the register is constant.
+	 */
+	bool is_constant(int reg, float& value) const;
+
+	/**
+	 * @brief Finalize the program.
+	 * @param[in] output Register holding the result.
+	 * @param[in] source Field the program is compiled from.
+	 * @return Compiled program.
+	 */
+	FieldProgram program(int output, std::shared_ptr<Field> source);
+
+private:
+
+	/// Instructions appended so far.
+	std::vector<FieldInstruction> m_instructions;
+
+	/// Operand lists of Sum instructions.
+	std::vector<std::pair<int, float>> m_operands;
+
+	/// Registers of the fields already compiled.
+	std::unordered_map<const Field*, int> m_visited;
+
+	/// Registers of the instructions already appended, for common subexpression elimination.
+	std::map<std::tuple<int, int, int, std::array<float, 6>, const Field*>, int> m_registers;
+
+};
+
+/**
+ * @brief Compile a field graph into a program.
+ * @param[in] field Root of the field graph.
+ * @return Program evaluating the field.
+ */
+FieldProgram compile(std::shared_ptr<Field> field);
+
+}
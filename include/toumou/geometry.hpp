@@ -1,6 +1,8 @@
 #pragma once
 
 #include <Imath/ImathVec.h>
+#include <Imath/ImathBox.h>
+#include <Imath/ImathInterval.h>
 
 
 namespace toumou {
@@ -10,6 +12,16 @@ namespace toumou {
  */
 using Vec3 = Imath::V3f;
 
+/**
+ * @brief Axis-aligned box in 3D space with float precision.
+ */
+using Box3 = Imath::Box3f;
+
+/**
+ * @brief Range of real numbers with float precision.
+ */
+using Interval = Imath::Intervalf;
+
 /**
  * @brief Half-line in 3D space.
  */
@@ -21,6 +33,12 @@ struct Ray {
 	/// Direction of the ray (normalized).
 	Vec3 dir;
 
+	/// Radius of the ray's footprint at its origin.
+	float width = 0.f;
+
+	/// Growth of the ray's footprint radius per unit of distance (the ray is a cone around its direction).
+	float spread = 0.f;
+
 	/**
 	 * @brief Constructor with parameter initilization.
 	 * @param[in] _origin Starting point of the ray.
@@ -35,6 +53,47 @@ struct Ray {
 	 */
 	Vec3 at(float t) const;
 
+	/**
+	 * @brief Compute the radius of the ray's footprint at a given distance, i.e. the size of the details it can resolve.
+	 * @param[in] t Distance from the ray's origin.
+	 * @return Radius of the cone around the ray at the given distance.
+	 */
+	float footprint(float t) const;
+
+};
+
+/**
+ * @brief Group of rays stored as a structure of arrays, so that they can be intersected together.
+ * 
+ * Packets always hold max_size rays: the lanes after size are padding, whose results are ignored.
+ */
+struct RayPacket {
+
+	/// Number of lanes of a packet.
+	static constexpr int max_size = 8;
+
+	/// Number of rays in the packet.
+	int size = 0;
+
+	/// Origin coordinates.
+	float origin_x[max_size], origin_y[max_size], origin_z[max_size];
+
+	/// Direction coordinates (normalized).
+	float dir_x[max_size], dir_y[max_size], dir_z[max_size];
+
+	/// Footprint radii at the origins, see Ray::width.
+	float width[max_size];
+
+	/// Footprint growths, see Ray::spread.
+	float spread[max_size];
+
+	/**
+	 * @brief Extract one of the rays of the packet.
+	 * @param[in] k Lane of the ray.
+	 * @return Ray in the given lane.
+	 */
+	Ray ray(int k) const;
+
 };
 
 /**
@@ -45,4 +104,68 @@ struct Ray {
  */
 Ray trace(const Vec3& from, const Vec3& to);
 
+/**
+ * @brief Create a box covering the whole 3D space.
+ */
+Box3 infinite_box();
+
+/**
+ * @brief Create an interval covering all real numbers.
+ */
+Interval infinite_interval();
+
+/**
+ * @brief Compute the smallest box containing a segment of a ray.
+ * @param[in] ray Ray supporting the segment.
+ * @param[in] t_start Distance from the ray's origin to the start of the segment.
+ * @param[in] t_end Distance from the ray's origin to the end of the segment.
+ * @return Bounding box of the segment.
+ */
+Box3 segment_bounds(const Ray& ray, float t_start, float t_end);
+
+/**
+ * @brief Check if a box has finite extents along all axes.
+ * @param[in] box Box to check.
+ * @return Whether or not the box is non-empty and finite.
+ */
+bool is_bounded(const Box3& box);
+
+/**
+ * @brief Check if an interval has finite ends.
+ * @param[in] interval Interval to check.
+ * @return Whether or not the interval is non-empty and finite.
+ */
+bool is_bounded(const Interval& interval);
+
+/**
+ * @brief Compute the intersection of two boxes.
+ * @param[in] a First box.
+ * @param[in] b Second box.
+ * @return Largest box contained in both boxes (empty if they do not overlap).
+ */
+Box3 intersection(const Box3& a, const Box3& b);
+
+/**
+ * @brief Compute the range of distances along a ray for which the ray is inside a box (slab method).
+ * @param[in] box Box to check for intersection.
+ * @param[in] ray Ray to check for intersection.
+ * @param[in] inv_dir Component-wise inverse of the ray's direction.
+ * @param[out] t_enter Distance at which the ray enters the box.
+ * @param[out] t_exit Distance at which the ray exits the box.
+ * @return Whether or not the ray crosses the box in front of its origin.
+ */
+bool intersect(const Box3& box, const Ray& ray, const Vec3& inv_dir, float& t_enter, float& t_exit);
+
+/**
+ * @brief Check if any ray of a packet crosses a box before a given distance (slab method, one lane per ray).
+ * @param[in] box Box to check for intersection.
+ * @param[in] packet Rays to check for intersection.
+ * @param[in] inv_x, inv_y, inv_z Component-wise inverses of the rays' directions.
+ * @param[in] t_max Distances along each ray beyond which the box is ignored.
+ * @param[out] t_enter Smallest distance at which one of the crossing rays enters the box.
+ * @return Whether or not one of the rays crosses the box in front of its origin and before its t_max.
+ */
+bool intersect(const Box3& box, const RayPacket& packet, const float* inv_x, const float* inv_y, const float* inv_z, 
+			   const float* t_max, float& t_enter);
+
 }
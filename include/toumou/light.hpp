@@ -1,12 +1,49 @@
 #pragma once
 
 #include <toumou/color.hpp>
+#include <toumou/constants.hpp>
 #include <toumou/geometry.hpp>
 #include <toumou/image.hpp>
 
+#include <algorithm>
+#include <limits>
+
 
 namespace toumou {
 
+/**
+ * @brief Sample the contribution of a point light at a given position in 3D space (see Light::sample).
+ * @param[in] location Position of the light source.
+ * @param[in] brightness Amount of energy provided by the light source.
+ * @param[in] pos Position where the light source contribution is to be sampled.
+ * @param[out] dir Light direction at the given position.
+ * @param[out] dist Distance to the light source at the given position.
+ * @param[out] intensity Light intensity at the given position.
+ */
+inline void sample_point_light(const Vec3& location, float brightness, const Vec3& pos, Vec3& dir, float& dist, float& intensity)
+{
+	dir = (location - pos).normalized();
+	dist = (pos - location).length();
+	float dist2 = std::max(dist * dist, eps_div_by_zero);
+	intensity = brightness / dist2;
+}
+
+/**
+ * @brief Sample the contribution of a directional light at a given position in 3D space (see Light::sample).
+ * @param[in] direction Direction of the light source.
+ * @param[in] brightness Amount of energy provided by the light source.
+ * @param[in] pos Position where the light source contribution is to be sampled.
+ * @param[out] dir Light direction at the given position.
+ * @param[out] dist Distance to the light source at the given position.
+ * @param[out] intensity Light intensity at the given position.
+ */
+inline void sample_directional_light(const Vec3& direction, float brightness, const Vec3& pos, Vec3& dir, float& dist, float& intensity)
+{
+	dir = direction;
+	dist = std::numeric_limits<float>::max();
+	intensity = brightness;
+}
+
 /**
  * @brief Abstract class for light source models.
  */
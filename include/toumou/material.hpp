@@ -2,6 +2,7 @@
 
 #include <toumou/color.hpp>
 #include <toumou/field.hpp>
+#include <toumou/field_compilation.hpp>
 #include <toumou/geometry.hpp>
 #include <toumou/macros.hpp>
 
@@ -43,6 +44,16 @@ struct Material {
 	/// TODO
 	std::shared_ptr<Field> blue = tmks(Constant, 1.f);
 
+	/**
+	 * @brief Compile the color fields into programs, used by color_at until the fields are replaced.
+	 */
+	void compile();
+
+private:
+
+	/// Compiled color fields.
+	FieldProgram m_red_program, m_green_program, m_blue_program;
+
 };
 
 }
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <toumou/field.hpp>
+#include <toumou/geometry.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+namespace toumou {
+
+/**
+ * @brief Coarse grid marking the cells of a box in which a field may reach a given level.
+ *
+ * A cell is empty when the field's range on the cell guarantees that the field stays below the level
+ * everywhere inside it. Rays walk the grid cell by cell to skip the empty cells and only search for roots 
+ * on the intervals covered by the other cells.
+ *
+ * The grid is built once per render and then only read, it can be shared by the rendering threads.
+ */
+class OccupancyGrid {
+public:
+
+	/// Default constructor, creates an empty grid that is not built from any field.
+	OccupancyGrid();
+
+	/**
+	 * @brief Build the grid of a field inside a box.
+	 * @param[in] field Field whose level set is looked for.
+	 * @param[in] level Level of the surface.
+	 * @param[in] box Region outside of which the field is assumed to stay below the level.
+	 * @param[in] resolution Number of cells along the longest side of the box.
+	 * @param[in] n_threads Number of building threads (0 means one thread per hardware thread).
+	 */
+	void build(std::shared_ptr<Field> field, float level, const Box3& box, int resolution, int n_threads = 0);
+
+	/// Check if the grid was built from a given field.
+	bool built_from(const Field* field) const;
+
+	/// Number of cells in which the field may reach the level.
+	int n_occupied() const;
+
+	/**
+	 * @brief Find the next range of distances along a ray covered by consecutive occupied cells.
+	 * @param[in] ray Ray walking the grid.
+	 * @param[in] t_start Distance from which the ray walks the grid.
+	 * @param[in] t_end Distance at which the walk stops.
+	 * @param[out] t_enter Distance at which the ray enters the first occupied cell.
+	 * @param[out] t_exit Distance at which the ray leaves the last occupied cell of the range (clamped to t_end).
+	 * @return Whether or not the ray crosses an occupied cell between t_start and t_end.
+	 */
+	bool next_interval(const Ray& ray, float t_start, float t_end, float& t_enter, float& t_exit) const;
+
+private:
+
+	/// Field the grid was built from.
+	const Field* m_source;
+
+	/// Box covered by the grid.
+	Box3 m_box;
+
+	/// Side of the (cubic) cells.
+	float m_cell_size;
+
+	/// Number of cells along each axis.
+	int m_n_cells[3];
+
+	/// Occupancy of each cell, x-major.
+	std::vector<std::uint8_t> m_occupied;
+
+	/// Check if a cell is occupied.
+	bool occupied(const int cell[3]) const;
+
+};
+
+}
@@ -1,18 +1,35 @@
 #pragma once
 
 #include <toumou/scene.hpp>
+#include <toumou/bvh.hpp>
 #include <toumou/image.hpp>
 #include <toumou/geometry.hpp>
 #include <toumou/color.hpp>
 #include <toumou/material.hpp>
+#include <toumou/sampling.hpp>
+#include <toumou/scheduling.hpp>
 
 #include <functional>
 #include <memory>
-#include <random>
+#include <vector>
 
 
 namespace toumou {
 
+/**
+ * @brief Algorithms available for computing indirect lighting.
+ */
+enum class Integrator {
+
+	/// Split each light path into rays_per_bounce diffuse and rays_per_bounce specular rays at every bounce.
+	Branching,
+
+	/// Follow a single light path per pixel sample, choosing one scattered ray per bounce 
+	/// and terminating paths with Russian roulette.
+	PathTracing
+
+};
+
 /**
  * @brief Ray tracing engine.
  */
@@ -25,12 +42,48 @@ public:
 	/// Maximum number of bounces for each light path.
 	int max_bounce = 4;
 
-	/// Number of rays emitted at each bounce.
+	/// Number of rays emitted at each bounce (branching integrator only).
 	int rays_per_bounce = 16;
 
+	/// Algorithm used for indirect lighting.
+	Integrator integrator = Integrator::Branching;
+
+	/// Number of bounces after which light paths can be terminated by Russian roulette (path tracing only).
+	int roulette_bounce = 2;
+
 	/// TODO
 	int env_sampling = 16;
 
+	/// Footprint growth per unit of distance of the rays scattered diffusely, see Ray::spread. 
+	/// Wider rays let implicit surfaces with a footprint scale search them with a looser tolerance.
+	float diffuse_spread = .3f;
+
+	/// Number of rendering threads (0 means one thread per hardware thread).
+	int n_threads = 0;
+
+	/// Width and height of the image tiles distributed over the rendering threads (in pixels).
+	int tile_size = 16;
+
+	/// Whether or not pixels stop taking samples once their estimate is precise enough, 
+	/// pixel_sampling is then the maximum number of samples per pixel.
+	bool adaptive_sampling = false;
+
+	/// Number of samples taken by every pixel before adaptive sampling can stop it (one packet of primary rays by default, 
+	/// so that a small light or highlight missed by the first few samples does not stop the pixel).
+	int min_pixel_sampling = RayPacket::max_size;
+
+	/// Half-width of the 95% confidence interval of a pixel's mean intensity, relative to the mean, 
+	/// under which adaptive sampling stops the pixel.
+	float noise_threshold = .05f;
+
+	/// Whether or not the primary rays of a pixel start their search for the surface hit by the pixel's previous sample 
+	/// near the previous hit (only implicit surfaces use the hint).
+	bool hit_hints = false;
+
+	/// Seed of the pseudo-random number generation, renders with the same seed are bit-identical 
+	/// whatever the number of threads or the tile size.
+	unsigned int seed = 0;
+
 	/// Color pass.
 	Image<Color> image;
 
@@ -43,6 +96,9 @@ public:
 	// Surface UID pass.
 	Image<float> index_map;
 
+	// Sample count pass.
+	Image<float> sample_map;
+
 	/**
 	 * @brief Create a ray tracer object for the given output dimensions.
 	 * @param[in] w Output image width.
@@ -51,32 +107,158 @@ public:
 	RayTracer(int w, int h);
 
 	/**
-	 * @brief Ray trace a given 3D scene.
+	 * @brief Ray trace a given 3D scene, discarding the samples of previous passes.
 	 * @param[in] scene Scene to render.
 	 * @param[in] progress_callback Function called everytime the computations progress by one percent of the total workload.
 	 */
 	void render(const Scene& scene, std::function<void(int)> progress_callback);
 
+	/**
+	 * @brief Add samples to the pixels of a given 3D scene, on top of the samples of previous passes.
+	 * 
+	 * Every pixel accumulates its samples from one pass to the next, and the passes are updated with the current estimate 
+	 * as soon as a tile is done. A pass continues the pixels' random sequences, so that several passes give the same image 
+	 * as a single render with as many samples (except for hit hints, which restart at each pass). 
+	 * With adaptive sampling, the pixels whose estimate is precise enough take no more samples.
+	 * 
+	 * Only the first pass after a reset prepares and commits the scene, later passes reuse its snapshot and 
+	 * acceleration structure. The snapshot copies the spheres, planes, tubes, point and directional lights 
+	 * and the materials, but shares the other objects (implicit surfaces, camera, environment light...): the scene 
+	 * and its objects must not be modified until reset is called, e.g. a new field or new root estimation parameters 
+	 * would be used at once with stale bounds and occupancy grids. 
+	 * A change of seed or of image dimensions resets the samples.
+	 * @param[in] scene Scene to render (read by the first pass after a reset only).
+	 * @param[in] n_samples Maximum number of samples added to each pixel.
+	 * @param[in] progress_callback Function called everytime the computations progress by one percent of the total workload.
+	 */
+	void render_pass(const Scene& scene, int n_samples, std::function<void(int)> progress_callback);
+
+	/// Discard the samples of previous passes, so that the next pass prepares the scene again and starts from scratch.
+	void reset();
+
 private:
 
-	/// Pseudo-random number generation.
-	mutable std::mt19937 m_gen;
-	mutable std::uniform_real_distribution<float> m_dis;
-	
-	/// Trace a ray from a camera's origin to a position on the image plane.
-	Ray cast(std::shared_ptr<Camera> camera, float x, float y, float aspect_ratio) const;
+	/// Snapshot of the rendered scene with its surfaces and lights sorted by type, taken by the first pass after a reset.
+	CommittedScene m_scene;
+
+	/// Acceleration structure over the scene's surfaces, updated by the first pass after a reset.
+	BVH m_bvh;
+
+	/// Camera vectors from which primary rays are generated, computed once per tile rather than once per ray.
+	struct CameraFrame {
+
+		/// Origin of the rays.
+		Vec3 origin;
+
+		/// Vector from the origin to the center of the image plane.
+		Vec3 center;
+
+		/// Offsets on the image plane for a unit change of the x and y image coordinates.
+		Vec3 x_axis, y_axis;
+
+		/// Spread of a ray times its distance to the image plane, so that its footprint covers a pixel.
+		float spread;
+
+	};
+
+	/// Samples and statistics of a pixel, accumulated over the passes and the sampling rounds of its tile.
+	struct PixelState {
+
+		/// Pixel row and column.
+		int i, j;
+
+		/// Random numbers of the pixel.
+		Sampler sampler;
+
+		/// Hit of the pixel's last sample.
+		HitHint hint;
+
+		/// Sum of the sample colors.
+		Color color_sum;
+
+		/// Sum of the normals at the samples' hits.
+		Vec3 normal_sum;
+
+		/// Distance of the closest hit.
+		float depth;
+
+		/// UID of the surface of the closest hit.
+		float uid;
+
+		/// Number of samples taken.
+		int n_samples;
+
+		/// Running mean and sum of squared deviations from the mean of the sample intensities (Welford's algorithm).
+		float mean, m2;
+
+		/// Whether or not the pixel takes samples in the next round.
+		bool active;
+
+		/// Number of samples of the pixel at the end of the current pass.
+		int pass_end;
+
+		/// Slot of the pixel's first sample in the colors of the current round.
+		int first_slot;
+
+		/// Number of samples of the pixel in the current round.
+		int n_slots;
+
+	};
+
+	/// Accumulation buffer: state of every pixel (row by row), kept from one pass to the next.
+	std::vector<PixelState> m_pixels;
+
+	/// Seed and image dimensions with which the accumulation buffer was started.
+	unsigned int m_seed = 0;
+	int m_width = 0, m_height = 0;
+
+	/// Add up to a given number of samples to all the pixels of an image tile of the committed scene, and store their estimates.
+	void render_tile(const Tile& tile, int n_samples);
+
+	/// Trace the samples of the active pixels of a tile for the current round in packets, storing their colors in the slots 
+	/// of the round's colors.
+	void trace_samples(const CameraFrame& frame, const std::vector<PixelState*>& pixels, std::vector<Color>& colors) const;
+
+	/// Trace a packet of samples, each given by its pixel and its index among the pixel's samples (see trace_samples).
+	void trace_packet(const CameraFrame& frame, PixelState* const* pixels, const int* samples, int n, std::vector<Color>& colors) const;
+
+	/// Check if the confidence interval of a pixel's mean intensity is narrow enough to stop sampling it.
+	bool converged(const PixelState& pixel) const;
+
+	/// Compute the frame of a camera for an image of a given aspect ratio, whose pixels have a given width.
+	CameraFrame frame(const Camera& camera, float aspect_ratio, float pixel_width) const;
+
+	/// Trace rays from a camera's origin to positions on the image plane (one per lane of the packet), 
+	/// whose footprints cover a pixel.
+	void cast(const CameraFrame& frame, const float* xs, const float* ys, RayPacket& packet) const;
+
+	/// Trace a ray from a surface point using spherical coordinates in the hemisphere oriented by the surface normal, 
+	/// with a given footprint at the surface point and a given spread.
+	Ray cast(const Vec3& pos, const Vec3& normal, float theta, float phi, float footprint, float spread) const;
+
+	/// Find first surface in the committed scene hit by a given ray, optionally knowing the hit of a neighbouring ray.
+	bool hit(const Ray& ray, HitRecord& record, const HitHint& hint = HitHint()) const;
+
+	/// Check if any surface in the committed scene blocks a given ray before a given distance.
+	bool occluded(const Ray& ray, float t_max) const;
+
+	/// Compute direct lighting at a given surface hit.
+	Color direct_lighting(const HitRecord& record, const Vec3& dir_view, Sampler& sampler) const;
 
-	/// Trace a ray from a surface point using spherical coordinates in the hemisphere oriented by the surface normal.
-	Ray cast(const Vec3& pos, const Vec3& normal, float theta, float phi) const;
+	/// Compute indirect lighting at a given surface hit.
+	Color indirect_lighting(const HitRecord& record, const Vec3& dir_view, int n_bounce, Sampler& sampler) const;
 
-	/// Find first surface in the scene hit by a given ray. 
-	std::shared_ptr<Surface> hit(const Ray& ray, const Scene& scene, float& t, Vec3& normal) const;
+	/// Compute indirect lighting at a given surface hit by following a single light path.
+	Color path_lighting(const HitRecord& record, const Vec3& dir_view, Sampler& sampler) const;
 
-	/// Compute direct lighting at a given surface point.
-	Color direct_lighting(std::shared_ptr<Surface> surface, const Scene& scene, const Vec3& pos, const Vec3& normal, const Vec3& dir_view) const;
+	/// Sample the ray scattered at the vertex of a light path for a given bounce, and update the path throughput.
+	/// Returns false if the path ends (ray below the surface or Russian roulette).
+	bool scatter(const HitRecord& vertex, const Vec3& dir_view, int bounce, Sampler& sampler, Color& throughput, Ray& ray) const;
 
-	/// Compute indirect lighting at a given surface point.
-	Color indirect_lighting(std::shared_ptr<Surface> surface, const Scene& scene, const Vec3& pos, const Vec3& normal, const Vec3& dir_view, int n_bounce) const;
+	/// Generate the rays towards the light sources at a given surface hit, passing each ray with its distance 
+	/// and a function computing its contribution if not blocked to a function, so that blocked rays need no shading.
+	template<typename Emit>
+	void light_rays(const HitRecord& record, const Vec3& dir_view, Sampler& sampler, Emit&& emit) const;
 
 	/// TODO
 	float brdf(const Material& mat, const Vec3& dir_light, const Vec3& dir_view, const Vec3& normal) const;
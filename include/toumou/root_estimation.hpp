@@ -1,19 +1,138 @@
 #pragma once
 
 #include <toumou/geometry.hpp>
+#include <toumou/field.hpp>
+#include <toumou/field_compilation.hpp>
 
-#include <functional>
+#include <cstddef>
+#include <cstdint>
 
 
 namespace toumou {
 
+/**
+ * @brief Field shifted so that one of its level sets becomes its zero set, evaluated through its compiled program if any.
+ * 
+ * This is the form in which implicit surfaces hand their field to the root estimation.
+ */
+class FieldLevel {
+public:
+
+	/**
+	 * @brief Shift a field by a level.
+	 * @param[in] field Field to shift.
+	 * @param[in] level Level of the field that becomes zero.
+	 * @param[in] program Compiled version of the field, used instead of it if not null.
+	 */
+	FieldLevel(const Field& field, float level, const FieldProgram* program = nullptr);
+
+	/// Field value minus the level.
+	float value(const Vec3& pos) const;
+
+	/// Field values minus the level at several positions at once, see Field::value_batch.
+	void value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const;
+
+	/// Field gradient.
+	Vec3 gradient(const Vec3& pos) const;
+
+	/// Field value minus the level, and derivative along a ray, see Field::value_and_ray_derivative.
+	float value_and_ray_derivative(const Ray& ray, float t, float& derivative) const;
+
+	/// Field's Lipschitz bound, see Field::lipschitz.
+	float lipschitz(const Vec3& center, float radius) const;
+
+	/// Field's range minus the level, see Field::range.
+	Interval range(const Box3& box) const;
+
+private:
+
+	/// Shifted field.
+	const Field& m_field;
+
+	/// Level of the field that becomes zero.
+	float m_level;
+
+	/// Compiled version of the field (may be null).
+	const FieldProgram* m_program;
+
+};
+
+/**
+ * @brief Algorithms available for the 1st pass of the root estimation.
+ */
+enum class RootSearch {
+
+	/// Sample the field with a fixed step.
+	Sampling,
+
+	/// Step as far as the field's local Lipschitz bound guarantees that no root can be skipped (segment tracing).
+	SphereTracing,
+
+	/// Bisect the search range, discarding the segments on which the field's range (interval arithmetic) excludes zero.
+	Isolation
+
+};
+
+/**
+ * @brief Counters of the work done by root searches, used to tune the root estimation parameters.
+ */
+struct RootStatistics {
+
+	/// Number of searches.
+	std::uint64_t searches = 0;
+
+	/// Number of roots found.
+	std::uint64_t roots = 0;
+
+	/// Number of field evaluations (with or without derivative).
+	std::uint64_t evaluations = 0;
+
+	/// Number of field range evaluations (root isolation only).
+	std::uint64_t range_evaluations = 0;
+
+	/// Number of refinement iterations.
+	std::uint64_t iterations = 0;
+
+	/// Number of refinements stopped by the iteration limit before reaching the threshold.
+	std::uint64_t failures = 0;
+
+	/// Number of searches started from a hint that fell back to a full search.
+	std::uint64_t hint_misses = 0;
+
+	/// Add the counters of other searches.
+	RootStatistics& operator+=(const RootStatistics& other);
+
+};
+
 /**
  * @brief Root estimation algorithm for detecting the zeros of a 3D field along a ray.
  * 
  * To compute the intersection between a ray and an implicit surface in the general case (when there is no close formula)
  * we use the 3D field that defines the given implicit surface and we apply the following root finding algorithm: 
  * 1. sample the field along the ray with a fixed step to find an interval on which the field sign changes
- * 2. apply Newton's algorithm on this interval to refine the root value
+ * 2. apply Newton's algorithm on this interval to refine the root value, falling back to regula falsi (Illinois variant)
+ *    whenever a Newton step leaves the interval, so that the root always stays bracketed
+ * 
+ * The samples of the 1st pass are evaluated in batches of consecutive positions along the ray, 
+ * which lets the field process several positions per instruction at the cost of a few samples past the root.
+ * 
+ * With sphere tracing, the 1st pass takes adaptive steps instead: the field's Lipschitz bound on a segment 
+ * ahead of the current position gives a distance over which the field cannot reach zero.
+ * 
+ * Rays carrying a footprint (ray cones) cannot resolve details smaller than it: with a footprint scale, 
+ * the sampling step and the threshold grow with the footprint along the ray, so that distant or blurry rays 
+ * need fewer evaluations.
+ * 
+ * With root isolation, the 1st pass bisects the search range and only keeps the segments on which the field 
+ * may reach zero according to its range, so that no sign change is skipped on segments longer than the threshold.
+ * 
+ * Coherent rays (e.g. the samples of a pixel) hit a surface at nearly the same distance: given the distance of a 
+ * neighbouring hit as a hint, the 1st pass can be replaced by a bracket around the hint, provided that the field's range 
+ * excludes any root before the bracket.
+ * 
+ * The fields are passed as template parameters so that their evaluation can be inlined in the search loops,
+ * a field type must provide the methods value, value_batch, value_and_ray_derivative, lipschitz and range of Field.
+ * The methods are instantiated for Field and FieldLevel.
  */
 struct RootEstimator {
 
@@ -26,24 +145,135 @@ struct RootEstimator {
 	/// Step used in the 1st pass to sample the field along the ray.
 	float sampling_step = .1f;
 
-	/// Criteria for determining if we are close enough to a solution.
+	/// Criteria for determining if we are close enough to a solution (absolute field value).
 	float threshold = 1e-3f;
 
 	/// Maximum number of iterations for the refinement pass.
 	int max_iterations = 10;
 
+	/// Algorithm used in the 1st pass.
+	RootSearch search = RootSearch::Sampling;
+
+	/// Maximum number of steps in the 1st pass with sphere tracing.
+	int max_steps = 256;
+
+	/// Ratio between the ray's footprint and the smallest sampling step allowed at a given distance (0 disables it).
+	/// Where the footprint times this ratio exceeds the sampling step, the step and the threshold grow in proportion.
+	float footprint_scale = 0.f;
+
 	/**
 	 * @brief Find the first point along a ray at which a field evaluates to zero.
 	 * @param[in] ray Ray on which we are looking for a root.
+	 * @param[in] field 3D field describing an implicit surface, sampled in batches.
+	 * @param[out] t_root Estimated root position along the ray.
+	 * @param[in,out] statistics Counters to which the work done is added (ignored if null).
+	 * @return Whether or not a root was found.
+	 */
+	template<typename F>
+	bool find_first_root(const Ray& ray, const F& field, float& t_root, RootStatistics* statistics = nullptr) const;
+
+	/**
+	 * @brief Find the first point along a ray at which a field evaluates to zero, using sphere tracing for the 1st pass.
+	 * @param[in] ray Ray on which we are looking for a root.
+	 * @param[in] field 3D field describing an implicit surface, whose Lipschitz bound sets the steps.
+	 * @param[out] t_root Estimated root position along the ray.
+	 * @param[in,out] statistics Counters to which the work done is added (ignored if null).
+	 * @return Whether or not a root was found.
+	 */
+	template<typename F>
+	bool trace_first_root(const Ray& ray, const F& field, float& t_root, RootStatistics* statistics = nullptr) const;
+
+	/**
+	 * @brief Find the first point along a ray at which a field evaluates to zero, using root isolation for the 1st pass.
+	 * 
+	 * Segments are bisected until they are shorter than the sampling step and the field is positive at their end,
+	 * segments shorter than the threshold on which the field stays negative at both ends are discarded.
+	 * @param[in] ray Ray on which we are looking for a root.
+	 * @param[in] field 3D field describing an implicit surface, whose range decides which segments are kept.
+	 * @param[out] t_root Estimated root position along the ray.
+	 * @param[in,out] statistics Counters to which the work done is added (ignored if null).
+	 * @return Whether or not a root was found.
+	 */
+	template<typename F>
+	bool isolate_first_root(const Ray& ray, const F& field, float& t_root, RootStatistics* statistics = nullptr) const;
+
+	/**
+	 * @brief Find the first point along a ray at which a field evaluates to zero, using the algorithm chosen for the 1st pass.
+	 * @param[in] ray Ray on which we are looking for a root.
 	 * @param[in] field 3D field describing an implicit surface.
-	 * @param[in] ray_derivative Derivative of the field restricted to a ray.
 	 * @param[out] t_root Estimated root position along the ray.
+	 * @param[in,out] statistics Counters to which the work done is added (ignored if null).
 	 * @return Whether or not a root was found.
 	 */
-	bool find_first_root(const Ray& ray,
-						 std::function<float(const Vec3&)> field,
-						 std::function<float(const Ray&, float)> ray_derivative,
-						 float& t_root) const;
+	template<typename F>
+	bool first_root(const Ray& ray, const F& field, float& t_root, RootStatistics* statistics = nullptr) const;
+
+	/**
+	 * @brief Find the first point along a ray at which a field evaluates to zero, starting near an expected distance.
+	 * 
+	 * The field is evaluated one sampling step before and after the hint, and the bracket is widened a few times 
+	 * until the field changes sign. The root inside the bracket is only kept if the field's range shows that the field 
+	 * stays negative before the bracket, otherwise (or if no bracket is found) the search falls back to first_root.
+	 * @param[in] ray Ray on which we are looking for a root.
+	 * @param[in] field 3D field describing an implicit surface, whose range checks that no root is skipped.
+	 * @param[in] t_hint Expected root position, ignored if outside of the search range.
+	 * @param[out] t_root Estimated root position along the ray.
+	 * @param[in,out] statistics Counters to which the work done is added (ignored if null).
+	 * @return Whether or not a root was found.
+	 */
+	template<typename F>
+	bool first_root_near(const Ray& ray, const F& field, float t_hint, float& t_root, RootStatistics* statistics = nullptr) const;
+
+	/**
+	 * @brief Check if a field has a root along a ray before a given distance.
+	 * 
+	 * Only the 1st pass of the algorithm is applied: the search stops at the first sign change
+	 * and the root is not refined.
+	 * @param[in] ray Ray on which we are looking for a root.
+	 * @param[in] field 3D field describing an implicit surface, sampled in batches.
+	 * @param[in] t_limit Distance beyond which roots are ignored.
+	 * @param[in,out] statistics Counters to which the work done is added (ignored if null).
+	 * @return Whether or not a root was found before t_limit.
+	 */
+	template<typename F>
+	bool has_root(const Ray& ray, const F& field, float t_limit, RootStatistics* statistics = nullptr) const;
+
+	/**
+	 * @brief Move the start of the search range past the band around it in which a field is within the threshold.
+	 * 
+	 * Rays leaving a surface (e.g. shadow rays) start on a root of its field, which a search would return at once: 
+	 * the start moves forward by sampling steps until the field leaves the threshold or the search range ends.
+	 * @param[in] ray Ray along which the search range is moved.
+	 * @param[in] field 3D field describing an implicit surface.
+	 * @param[in,out] statistics Counters to which the work done is added (ignored if null).
+	 * @return Whether or not the search range is still non-empty.
+	 */
+	template<typename F>
+	bool leave_root(const Ray& ray, const F& field, RootStatistics* statistics = nullptr);
+
+private:
+
+	/// Factor (at least 1) by which the sampling step and the threshold are multiplied at a given distance along a ray.
+	float detail(const Ray& ray, float t) const;
+
+	/// 1st pass with sampling steps: find the first positive sample from t_min on (positions clamped to t_clamp), 
+	/// a sample is only taken if the previous one is before t_end. Returns whether there is one, and outputs 
+	/// the positions and values of the sample and of the previous one.
+	template<typename F>
+	bool first_positive_sample(const Ray& ray, const F& field, float t_end, float t_clamp, float& t_before, float& value_before, 
+							   float& t_after, float& value_after, RootStatistics* statistics) const;
+
+	/// Check with the field's range that the field stays negative between two distances along a ray, 
+	/// giving up after a fixed number of segments.
+	template<typename F>
+	bool excludes_root(const Ray& ray, const F& field, float t_start, float t_end, RootStatistics* statistics) const;
+
+	/// 2nd pass: refine a root bracketed by t_lo (non-positive value) and t_hi (positive value) until the field is 
+	/// within the threshold (scaled at t_lo). Newton steps are taken when they stay inside the bracket, regula falsi steps otherwise,
+	/// each step evaluates the field and its derivative together and shrinks the bracket.
+	template<typename F>
+	float refine(const Ray& ray, const F& field, float t_lo, float value_lo, float t_hi, float value_hi, 
+				 RootStatistics* statistics) const;
 
 };
 
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+
+
+namespace toumou {
+
+/**
+ * @brief Counter-based pseudo-random number generation.
+ * 
+ * Random numbers are not drawn from a sequential generator but obtained by hashing their coordinates:
+ * (seed, pixel, sample index, bounce, dimension). The value of a random number thus only depends on 
+ * where it is used, not on the order in which pixels, samples or threads are processed, 
+ * which makes renders reproducible however the work is split.
+ */
+class Sampler {
+public:
+
+	/**
+	 * @brief Create a sampler for a given pixel.
+	 * @param[in] seed Seed of the render.
+	 * @param[in] pixel Linear index of the pixel in the image.
+	 */
+	Sampler(std::uint32_t seed, std::uint32_t pixel);
+
+	/**
+	 * @brief Start a new pixel sample, resets the bounce and dimension counters.
+	 * @param[in] index Index of the sample in the pixel.
+	 */
+	void start_sample(std::uint32_t index);
+
+	/**
+	 * @brief Start a new bounce of the current sample's light path, resets the dimension counter.
+	 * @param[in] bounce Index of the bounce in the light path.
+	 */
+	void start_bounce(std::uint32_t bounce);
+
+	/**
+	 * @brief Draw the next random number of the current bounce.
+	 * @return Uniformly distributed random number in [0, 1).
+	 */
+	float next();
+
+	/**
+	 * @brief Skip random numbers of the current bounce, e.g. because they were already computed with get.
+	 * @param[in] count Number of random numbers to skip.
+	 */
+	void skip(std::uint32_t count);
+
+	/**
+	 * @brief Compute a random number from its coordinates, without changing the sampler's state.
+	 * @param[in] sample Index of the sample in the pixel.
+	 * @param[in] bounce Index of the bounce in the light path.
+	 * @param[in] dimension Index of the random number in the bounce.
+	 * @return Uniformly distributed random number in [0, 1).
+	 */
+	float get(std::uint32_t sample, std::uint32_t bounce, std::uint32_t dimension) const;
+
+private:
+
+	/// Hashed render seed.
+	std::uint32_t m_seed;
+
+	/// Pixel index.
+	std::uint32_t m_pixel;
+
+	/// Current sample index.
+	std::uint32_t m_sample;
+
+	/// Current bounce index.
+	std::uint32_t m_bounce;
+
+	/// Index of the next random number in the current bounce.
+	std::uint32_t m_dimension;
+
+};
+
+}
@@ -3,12 +3,17 @@
 #include <toumou/camera.hpp>
 #include <toumou/light.hpp>
 #include <toumou/surface.hpp>
+#include <toumou/material.hpp>
+#include <toumou/scene_arrays.hpp>
 
+#include <memory>
 #include <vector>
 
 
 namespace toumou {
 
+class CommittedScene;
+
 /**
  * @brief Reference and access the objects in a 3D scene.
  */
@@ -23,13 +28,21 @@ public:
 
 	void set_env_light(std::shared_ptr<EnvironmentLight> light);
 
-	std::shared_ptr<Camera> camera() const;
+	const std::shared_ptr<Camera>& camera() const;
 
 	const std::vector<std::shared_ptr<Light>>& lights() const;
 
 	const std::vector<std::shared_ptr<Surface>>& surfaces() const;
 
-	std::shared_ptr<EnvironmentLight> env_light() const;
+	const std::shared_ptr<EnvironmentLight>& env_light() const;
+
+	/**
+	 * @brief Take a snapshot of the scene for rendering, with its surfaces and lights sorted by type.
+	 * 
+	 * Surfaces should be prepared beforehand, their materials are copied with their compiled programs.
+	 * @return Committed version of the scene, unaffected by later changes to the scene's lists.
+	 */
+	CommittedScene commit() const;
 
 private:
 
@@ -43,4 +56,104 @@ private:
 
 };
 
+/**
+ * @brief Type of a surface in a committed scene.
+ */
+enum class SurfaceType {
+
+	/// Sphere, stored in SphereArrays.
+	Sphere,
+
+	/// Plane, stored in PlaneArrays.
+	Plane,
+
+	/// Tube, stored in TubeArrays.
+	Tube,
+
+	/// Implicit surface, called through its exact type.
+	Implicit,
+
+	/// Any other surface, called through the Surface interface.
+	Other
+
+};
+
+/**
+ * @brief Snapshot of a scene for rendering, with its surfaces and lights sorted by type into contiguous arrays.
+ * 
+ * Spheres, planes, tubes, point lights and directional lights are copied as structures of arrays and tested in 
+ * loops over a single type, without virtual calls. Implicit surfaces are referenced through their exact type
+ * so that their methods are called directly, and objects of other types are kept behind their base class.
+ * 
+ * The snapshot shares the ownership of the scene's objects, which stay alive as long as it exists.
+ */
+class CommittedScene {
+public:
+
+	/// Camera of the scene.
+	std::shared_ptr<Camera> camera;
+
+	/// Surfaces in the order of the scene, their index identifies them in the rest of the snapshot.
+	std::vector<std::shared_ptr<Surface>> surfaces;
+
+	/// Type of each surface.
+	std::vector<SurfaceType> types;
+
+	/// Index of each surface in the array of its type (in other_surfaces for other types).
+	std::vector<int> type_indices;
+
+	/// Copy of the material of each surface.
+	std::vector<Material> materials;
+
+	/// Spheres.
+	SphereArrays spheres;
+
+	/// Planes.
+	PlaneArrays planes;
+
+	/// Tubes.
+	TubeArrays tubes;
+
+	/// Implicit surfaces.
+	std::vector<const ImplicitSurface*> implicit_surfaces;
+
+	/// Index of each implicit surface among the surfaces.
+	std::vector<int> implicit_indices;
+
+	/// Index of the surfaces of other types among the surfaces.
+	std::vector<int> other_surfaces;
+
+	/// Lights in the order of the scene.
+	std::vector<std::shared_ptr<Light>> lights;
+
+	/// Point lights.
+	PointLightArrays point_lights;
+
+	/// Directional lights.
+	DirectionalLightArrays directional_lights;
+
+	/// Lights of other types.
+	std::vector<const Light*> other_lights;
+
+	/// Environment light (may be null).
+	std::shared_ptr<EnvironmentLight> env_light;
+
+	/// Total number of lights, not counting the environment light.
+	int n_lights() const;
+
+	/**
+	 * @brief Sample the contribution of a light at a given position in 3D space.
+	 * 
+	 * Lights are numbered by type: point lights first, then directional lights, then the other lights.
+	 * @param[in] k Index of the light.
+	 * @param[in] pos Position where the light source contribution is to be sampled.
+	 * @param[out] dir Light direction at the given position.
+	 * @param[out] dist Distance to the light source at the given position.
+	 * @param[out] intensity Light intensity at the given position.
+	 * @param[out] color Light color.
+	 */
+	void sample_light(int k, const Vec3& pos, Vec3& dir, float& dist, float& intensity, Color& color) const;
+
+};
+
 }
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <toumou/color.hpp>
+#include <toumou/geometry.hpp>
+#include <toumou/light.hpp>
+#include <toumou/surface.hpp>
+
+#include <vector>
+
+
+namespace toumou {
+
+/**
+ * @brief Spheres stored as a structure of arrays, so that they can be tested without virtual calls.
+ */
+struct SphereArrays {
+
+	/// Center coordinates.
+	std::vector<float> center_x, center_y, center_z;
+
+	/// Radii.
+	std::vector<float> radius;
+
+	/// Index of each sphere among the surfaces of the committed scene.
+	std::vector<int> surface;
+
+	/// Append a copy of a sphere.
+	void add(const Sphere& sphere, int index);
+
+	/// Number of spheres.
+	int size() const;
+
+	/// Same as Sphere::hit for the k-th sphere, without computing the normal.
+	bool hit(int k, const Ray& ray, float& t) const;
+
+	/// Intersect the k-th sphere with all the rays of a packet, updating the distance and surface index of the rays' closest hits.
+	void hit(int k, const RayPacket& packet, float* t_closest, int* closest) const;
+
+	/// Same as Sphere::occluded for the k-th sphere.
+	bool occluded(int k, const Ray& ray, float t_max) const;
+
+	/// Normal of the k-th sphere at a position on it.
+	Vec3 normal(int k, const Vec3& pos) const;
+
+	/// Bounding box of the k-th sphere.
+	Box3 bounds(int k) const;
+
+};
+
+/**
+ * @brief Planes stored as a structure of arrays, so that they can be tested without virtual calls.
+ */
+struct PlaneArrays {
+
+	/// Origin coordinates.
+	std::vector<float> origin_x, origin_y, origin_z;
+
+	/// Normal coordinates.
+	std::vector<float> normal_x, normal_y, normal_z;
+
+	/// Index of each plane among the surfaces of the committed scene.
+	std::vector<int> surface;
+
+	/// Append a copy of a plane.
+	void add(const Plane& plane, int index);
+
+	/// Number of planes.
+	int size() const;
+
+	/// Same as Plane::hit for the k-th plane, without computing the normal.
+	bool hit(int k, const Ray& ray, float& t) const;
+
+	/// Intersect the k-th plane with all the rays of a packet, updating the distance and surface index of the rays' closest hits.
+	void hit(int k, const RayPacket& packet, float* t_closest, int* closest) const;
+
+	/// Same as Plane::occluded for the k-th plane.
+	bool occluded(int k, const Ray& ray, float t_max) const;
+
+	/// Normal of the k-th plane.
+	Vec3 normal(int k) const;
+
+};
+
+/**
+ * @brief Tubes stored as a structure of arrays, so that they can be tested without virtual calls.
+ */
+struct TubeArrays {
+
+	/// Origin coordinates.
+	std::vector<float> origin_x, origin_y, origin_z;
+
+	/// Direction coordinates.
+	std::vector<float> direction_x, direction_y, direction_z;
+
+	/// Radii.
+	std::vector<float> radius;
+
+	/// Index of each tube among the surfaces of the committed scene.
+	std::vector<int> surface;
+
+	/// Append a copy of a tube.
+	void add(const Tube& tube, int index);
+
+	/// Number of tubes.
+	int size() const;
+
+	/// Same as Tube::hit for the k-th tube, without computing the normal.
+	bool hit(int k, const Ray& ray, float& t) const;
+
+	/// Intersect the k-th tube with all the rays of a packet, updating the distance and surface index of the rays' closest hits.
+	void hit(int k, const RayPacket& packet, float* t_closest, int* closest) const;
+
+	/// Same as Tube::occluded for the k-th tube.
+	bool occluded(int k, const Ray& ray, float t_max) const;
+
+	/// Normal of the k-th tube at a position on it.
+	Vec3 normal(int k, const Vec3& pos) const;
+
+};
+
+/**
+ * @brief Point lights stored as a structure of arrays, so that they can be sampled without virtual calls.
+ */
+struct PointLightArrays {
+
+	/// Location coordinates.
+	std::vector<float> location_x, location_y, location_z;
+
+	/// Colors.
+	std::vector<Color> color;
+
+	/// Brightnesses.
+	std::vector<float> brightness;
+
+	/// Append a copy of a point light.
+	void add(const PointLight& light);
+
+	/// Number of point lights.
+	int size() const;
+
+	/// Same as PointLight::sample for the k-th light.
+	void sample(int k, const Vec3& pos, Vec3& dir, float& dist, float& intensity) const;
+
+};
+
+/**
+ * @brief Directional lights stored as a structure of arrays, so that they can be sampled without virtual calls.
+ */
+struct DirectionalLightArrays {
+
+	/// Direction coordinates.
+	std::vector<float> direction_x, direction_y, direction_z;
+
+	/// Colors.
+	std::vector<Color> color;
+
+	/// Brightnesses.
+	std::vector<float> brightness;
+
+	/// Append a copy of a directional light.
+	void add(const DirectionalLight& light);
+
+	/// Number of directional lights.
+	int size() const;
+
+	/// Same as DirectionalLight::sample for the k-th light.
+	void sample(int k, const Vec3& pos, Vec3& dir, float& dist, float& intensity) const;
+
+};
+
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace toumou {
+
+/**
+ * @brief Rectangular block of pixels.
+ */
+struct Tile {
+
+	/// First pixel row of the tile.
+	int i_min;
+
+	/// Pixel row following the last row of the tile.
+	int i_max;
+
+	/// First pixel column of the tile.
+	int j_min;
+
+	/// Pixel column following the last column of the tile.
+	int j_max;
+
+	/// Number of pixels in the tile.
+	int area() const;
+
+};
+
+/**
+ * @brief Work-stealing distribution of image tiles over worker threads.
+ * 
+ * The image is split into square tiles which are dealt in contiguous chunks to the workers' queues.
+ * Each worker consumes tiles from the front of its own queue, and once it is empty 
+ * it steals tiles from the back of the other workers' queues.
+ */
+class TileScheduler {
+public:
+
+	/**
+	 * @brief Split an image into tiles and distribute them over the workers.
+	 * @param[in] width Image width.
+	 * @param[in] height Image height.
+	 * @param[in] tile_size Width and height of the tiles (in pixels).
+	 * @param[in] n_workers Number of worker threads.
+	 */
+	TileScheduler(int width, int height, int tile_size, int n_workers);
+
+	/**
+	 * @brief Retrieve the next tile to process for a given worker.
+	 * @param[in] worker Index of the worker asking for work.
+	 * @param[out] tile Next tile to process (if there is one left).
+	 * @return Whether or not a tile was retrieved, false means all the tiles have been handed out.
+	 */
+	bool next(int worker, Tile& tile);
+
+	/// Total number of tiles.
+	int n_tiles() const;
+
+private:
+
+	/// Tile queue owned by a worker.
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Tile> tiles;
+	};
+
+	/// One queue per worker.
+	std::vector<std::unique_ptr<Queue>> m_queues;
+
+	/// Total number of tiles.
+	int m_n_tiles;
+
+};
+
+/**
+ * @brief Worker threads running the same task, which cannot outlive the group nor let an exception escape.
+ * 
+ * An exception thrown by the task is caught in its thread and stops the group, the first one is rethrown by join 
+ * on the calling thread. Tasks should check stopped between work items, so that the remaining work is abandoned 
+ * once a task has failed or the group is destroyed before being joined (e.g. during the unwinding of an exception 
+ * thrown on the calling thread).
+ */
+class WorkerGroup {
+public:
+
+	WorkerGroup() = default;
+	WorkerGroup(const WorkerGroup&) = delete;
+	WorkerGroup& operator=(const WorkerGroup&) = delete;
+
+	/// Stop the group and wait for its threads, ignoring their exceptions.
+	~WorkerGroup();
+
+	/**
+	 * @brief Start worker threads.
+	 * @param[in] n_workers Number of worker threads.
+	 * @param[in] task Function run by each worker, called with the worker's index.
+	 */
+	void start(int n_workers, std::function<void(int)> task);
+
+	/// Whether or not the workers should abandon the remaining work.
+	bool stopped() const;
+
+	/// Ask the workers to abandon the remaining work.
+	void stop();
+
+	/// Wait for all the workers, then rethrow the first exception thrown by a task (if any).
+	void join();
+
+private:
+
+	/// Function run by each worker.
+	std::function<void(int)> m_task;
+
+	/// Whether or not the workers should abandon the remaining work.
+	std::atomic<bool> m_stopped{ false };
+
+	/// First exception thrown by a task, and its lock.
+	std::exception_ptr m_error;
+	std::mutex m_mutex;
+
+	/// Worker threads.
+	std::vector<std::thread> m_threads;
+
+};
+
+/**
+ * @brief Run a function on every index of a range, distributing the indices over worker threads.
+ * 
+ * Indices are handed out one at a time, which suits work items of uneven cost.
+ * If the function throws, the remaining indices are skipped and the first exception is rethrown once all the workers are done.
+ * @param[in] n Number of indices, the function is called on every index in [0, n).
+ * @param[in] n_threads Number of worker threads (0 means one thread per hardware thread).
+ * @param[in] function Function to call on each index.
+ */
+void parallel_for(int n, int n_threads, const std::function<void(int)>& function);
+
+}
@@ -1,15 +1,91 @@
 #pragma once
 
+#include <toumou/constants.hpp>
 #include <toumou/geometry.hpp>
 #include <toumou/material.hpp>
 #include <toumou/root_estimation.hpp>
 #include <toumou/field.hpp>
+#include <toumou/field_compilation.hpp>
+#include <toumou/occupancy.hpp>
 
+#include <cmath>
+#include <limits>
 #include <memory>
+#include <mutex>
 
 
 namespace toumou {
 
+/**
+ * @brief Intersect a ray with a sphere.
+ * 
+ * The computation has no branch, so that the loops over the rays of a packet can be vectorized.
+ * @param[in] ray_origin Starting point of the ray.
+ * @param[in] ray_dir Direction of the ray (normalized).
+ * @param[in] center Sphere center.
+ * @param[in] radius Sphere radius.
+ * @param[out] t Distance of the first intersection beyond eps_ray_sep (meaningless if there is none).
+ * @return Whether or not the ray hits the sphere beyond eps_ray_sep.
+ */
+inline bool intersect_sphere(const Vec3& ray_origin, const Vec3& ray_dir, const Vec3& center, float radius, float& t)
+{
+	const Vec3 o = ray_origin - center;
+	const float b = 2.f * ray_dir.dot(o);
+	const float c = o.length2() - radius * radius;
+
+	const float delta = b * b - 4.f * c;
+	const float root = std::sqrt(delta > 0.f ? delta : 0.f);
+	const float t1 = (-b - root) * .5f;
+	const float t2 = (-b + root) * .5f;
+	t = t1 > eps_ray_sep ? t1 : t2;
+	return delta >= 0.f && t2 >= eps_ray_sep;
+}
+
+/**
+ * @brief Intersect a ray with a plane, without branches (see intersect_sphere).
+ * @param[in] ray_origin Starting point of the ray.
+ * @param[in] ray_dir Direction of the ray (normalized).
+ * @param[in] origin Plane origin.
+ * @param[in] normal Plane normal (normalized).
+ * @param[out] t Distance of the intersection (meaningless if there is none).
+ * @return Whether or not the ray hits the plane beyond eps_ray_sep.
+ */
+inline bool intersect_plane(const Vec3& ray_origin, const Vec3& ray_dir, const Vec3& origin, const Vec3& normal, float& t)
+{
+	const float alpha = normal.dot(origin - ray_origin);
+	const float beta = ray_dir.dot(normal);
+
+	const bool parallel = std::abs(beta) < eps_div_by_zero;
+	t = alpha / (parallel ? 1.f : beta);
+	return !parallel && t >= eps_ray_sep;
+}
+
+/**
+ * @brief Intersect a ray with a tube, without branches (see intersect_sphere).
+ * @param[in] ray_origin Starting point of the ray.
+ * @param[in] ray_dir Direction of the ray (normalized).
+ * @param[in] origin Tube origin.
+ * @param[in] direction Tube direction (normalized).
+ * @param[in] radius Tube radius.
+ * @param[out] t Distance of the first intersection beyond eps_ray_sep (meaningless if there is none).
+ * @return Whether or not the ray hits the tube beyond eps_ray_sep.
+ */
+inline bool intersect_tube(const Vec3& ray_origin, const Vec3& ray_dir, const Vec3& origin, const Vec3& direction, float radius, float& t)
+{
+	const Vec3 v1 = ray_dir - direction * ray_dir.dot(direction);
+	const Vec3 v2 = ray_origin - origin - direction * direction.dot(ray_origin - origin);
+	const float a = v1.length2();
+	const float b = 2.f * v1.dot(v2);
+	const float c = v2.length2() - (radius * radius);
+
+	const float delta = b * b - 4.f * a * c;
+	const float root = std::sqrt(delta > 0.f ? delta : 0.f);
+	const float t1 = (-b - root) / (2.f * a);
+	const float t2 = (-b + root) / (2.f * a);
+	t = t1 > eps_ray_sep ? t1 : t2;
+	return delta >= 0.f && !(t1 < eps_ray_sep && t2 < eps_ray_sep);
+}
+
 /**
  * @brief Abstract class for surface models.
  */
@@ -43,6 +119,44 @@ public:
 	 */
 	virtual bool hit(const Ray& ray, float& t, Vec3& n) const = 0;
 
+	/**
+	 * @brief Check if the given ray intersects this surface, knowing that a neighbouring ray hit it at a given distance.
+	 * 
+	 * The hint only speeds up the search, the result is the same as hit's (up to the root estimation's accuracy).
+	 * The default implementation ignores the hint.
+	 * @param[in] ray Ray to check for intersection.
+	 * @param[in] t_hint Distance at which a neighbouring ray hit this surface.
+	 * @param[out] t Distance between the ray's origin and the hit (if a hit has been found).
+	 * @param[out] n Surface normal at the hit (if a hit has been found).
+	 * @return Whether or not an intersection point was found.
+	 */
+	virtual bool hit_near(const Ray& ray, float t_hint, float& t, Vec3& n) const;
+
+	/**
+	 * @brief Check if the given ray is blocked by this surface before a given distance.
+	 * 
+	 * Unlike hit, this does not look for the closest intersection nor compute the surface normal,
+	 * which makes it cheaper for visibility queries such as shadow rays.
+	 * @param[in] ray Ray to check for occlusion.
+	 * @param[in] t_max Distance from the ray's origin beyond which intersections are ignored.
+	 * @return Whether or not the ray intersects this surface before t_max.
+	 */
+	virtual bool occluded(const Ray& ray, float t_max) const;
+
+	/**
+	 * @brief Compute an axis-aligned box enclosing this surface.
+	 * @return Bounding box of the surface, infinite for unbounded surfaces.
+	 */
+	virtual Box3 bounds() const;
+
+	/**
+	 * @brief Precompute the data used for rendering, called at the start of each render.
+	 * 
+	 * The default implementation compiles the material's color fields.
+	 * @param[in] n_threads Number of threads the precomputations may use (0 means one thread per hardware thread).
+	 */
+	virtual void prepare(int n_threads = 0);
+
 };
 
 /**
@@ -64,6 +178,10 @@ public:
 
 	bool hit(const Ray& ray, float& t, Vec3& n) const override;
 
+	bool occluded(const Ray& ray, float t_max) const override;
+
+	Box3 bounds() const override;
+
 };
 
 /**
@@ -85,6 +203,8 @@ public:
 
 	bool hit(const Ray& ray, float& t, Vec3& n) const override;
 
+	bool occluded(const Ray& ray, float t_max) const override;
+
 };
 
 /**
@@ -109,6 +229,8 @@ public:
 
 	bool hit(const Ray& ray, float& t, Vec3& n) const override;
 
+	bool occluded(const Ray& ray, float t_max) const override;
+
 };
 
 /**
@@ -128,8 +250,76 @@ public:
 	/// Provide access to the root estimation algorithm parameters.
 	RootEstimator root_estimator;
 
+	/// User-provided box enclosing the surface, used when the field cannot bound itself (infinite by default).
+	Box3 bounding_box;
+
+	/// Number of octree subdivisions used to shrink the bounding box with the field's range (0 keeps the box as is).
+	int bounds_depth = 4;
+
+	/// Number of cells along the longest side of the surface's occupancy grid (0 disables empty space skipping).
+	/// The grid is only built for bounded surfaces.
+	int occupancy_resolution = 0;
+
+	/// Whether or not the work done by the root searches is counted (off by default, counting synchronizes the rendering threads).
+	bool collect_statistics = false;
+
 	virtual bool hit(const Ray& ray, float& t, Vec3& n) const override;
 
+	/// Starts the root search with a bracket around the hint.
+	virtual bool hit_near(const Ray& ray, float t_hint, float& t, Vec3& n) const override;
+
+	virtual bool occluded(const Ray& ray, float t_max) const override;
+
+	/// Work done by the root searches since the last reset, when collect_statistics is enabled.
+	RootStatistics statistics() const;
+
+	/// Set the root search counters back to zero.
+	void reset_statistics();
+
+	/// Intersection of the user-provided bounding box and of the bounds reported by the field, 
+	/// shrunk with the field's range once the surface is prepared.
+	virtual Box3 bounds() const override;
+
+	/// Also compiles the field, shrinks its bounding box and builds its occupancy grid.
+	virtual void prepare(int n_threads = 0) override;
+
+private:
+
+	/// Compiled field, used until the field is replaced.
+	FieldProgram m_program;
+
+	/// Bounding box shrunk with the field's range, used until the field is replaced.
+	Box3 m_bounds;
+
+	/// Cells of the bounding box in which the surface may lie, used until the field is replaced.
+	OccupancyGrid m_occupancy;
+
+	/// Work done by the root searches, accumulated by the rendering threads.
+	mutable RootStatistics m_statistics;
+
+	/// Mutex protecting the root search counters.
+	mutable std::mutex m_statistics_mutex;
+
+	/// Run a root search (which returns whether it found a root and adds its work to the given counters) with search_intervals, 
+	/// and accumulate its work if statistics are collected.
+	template<typename Search>
+	bool search_occupied(const Ray& ray, const FieldLevel& level, Search search, float t_max = std::numeric_limits<float>::max()) const;
+
+	/// Run a root search (which returns whether it found a root) on each range of occupied cells crossed by a ray 
+	/// until it succeeds, or on the part of the search range inside the bounding box if there is no occupancy grid.
+	/// The search range also ends at t_max (e.g. the distance of a light).
+	template<typename Search>
+	bool search_intervals(const Ray& ray, const FieldLevel& level, Search search, float t_max = std::numeric_limits<float>::max()) const;
+
+	/// Intersection of the user-provided bounding box and of the bounds reported by the field.
+	Box3 unrefined_bounds() const;
+
+	/// Field shifted to the surface's level, evaluated through its compiled program if it is up to date.
+	FieldLevel level_field() const;
+
+	/// Surface normal at a root found along a ray.
+	Vec3 normal_at(const Ray& ray, const FieldLevel& level, float t) const;
+
 };
 
 }
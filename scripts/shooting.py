@@ -61,6 +61,10 @@ class Shooting:
 								rt.rays_per_bounce = render_params['rays_per_bounce']
 							if 'env_sampling' in render_params:
 								rt.env_sampling = render_params['env_sampling']
+							if 'integrator' in render_params:
+								rt.integrator = render_params['integrator']
+							if 'n_threads' in render_params:
+								rt.n_threads = render_params['n_threads']
 
 							rt.render(scene, Shooting.print_progress)
 
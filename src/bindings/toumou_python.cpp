@@ -2,6 +2,7 @@
 
 #include <pybind11/pybind11.h>
 #include <pybind11/functional.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 
 #include <memory>
@@ -20,6 +21,20 @@ std::shared_ptr<Class> TMKS(Args... args)
 #define PYTMKS(Class, ...) py::init(&TMKS<Class, __VA_ARGS__>)
 
 
+using FloatArray = py::array_t<float, py::array::c_style | py::array::forcecast>;
+
+template<typename Evaluator>
+FloatArray value_batch(const Evaluator& evaluator, FloatArray xs, FloatArray ys, FloatArray zs)
+{
+	if (xs.size() != ys.size() || xs.size() != zs.size()) {
+		throw py::value_error("coordinate arrays must have the same size");
+	}
+	FloatArray out(xs.size());
+	evaluator.value_batch(xs.data(), ys.data(), zs.data(), out.mutable_data(), static_cast<std::size_t>(xs.size()));
+	return out;
+}
+
+
 PYBIND11_MODULE(toumou, m) 
 {
 	m.doc() = "Python bindings for Toumou";
@@ -41,10 +56,27 @@ PYBIND11_MODULE(toumou, m)
 	py::class_<Ray>(m, "Ray")
 		.def_readonly("origin", &Ray::origin)
 		.def_readonly("dir", &Ray::dir)
-		.def("at", &Ray::at);
+		.def_readwrite("width", &Ray::width)
+		.def_readwrite("spread", &Ray::spread)
+		.def("at", &Ray::at)
+		.def("footprint", &Ray::footprint);
 
 	m.def("trace", &trace);
 
+	py::class_<Interval>(m, "Interval")
+		.def(py::init<float, float>(),
+			py::arg("min"),
+			py::arg("max"))
+		.def_readwrite("min", &Interval::min)
+		.def_readwrite("max", &Interval::max);
+
+	py::class_<Box3>(m, "Box3")
+		.def(py::init<const Vec3&, const Vec3&>(),
+			py::arg("min"),
+			py::arg("max"))
+		.def_readwrite("min", &Box3::min)
+		.def_readwrite("max", &Box3::max);
+
 	// Color
 
 	py::class_<Color>(m, "Color")
@@ -112,7 +144,18 @@ PYBIND11_MODULE(toumou, m)
 	// Field
 
 	py::class_<Field, std::shared_ptr<Field>>(m, "Field")
-		.def("value", &Field::value);
+		.def("value", &Field::value)
+		.def("gradient", &Field::gradient)
+		.def("value_and_gradient", &Field::value_and_gradient)
+		.def("value_batch", &value_batch<Field>,
+			py::arg("xs"),
+			py::arg("ys"),
+			py::arg("zs"))
+		.def("lipschitz", &Field::lipschitz,
+			py::arg("center"),
+			py::arg("radius"))
+		.def("range", &Field::range,
+			py::arg("box"));
 
 	py::class_<Constant, std::shared_ptr<Constant>, Field>(m, "Constant")
 		.def(PYTMKS(Constant, float),
@@ -124,6 +167,19 @@ PYBIND11_MODULE(toumou, m)
 			py::arg("field"),
 			py::arg("coef"));
 
+	py::class_<GridFusion, std::shared_ptr<GridFusion>, Field>(m, "GridFusion")
+		.def(PYTMKS(GridFusion, float, float),
+			py::arg("cell_size"),
+			py::arg("cutoff") = 1e-3f)
+		.def("add", py::overload_cast<std::shared_ptr<Field>, float>(&GridFusion::add),
+			py::arg("field"),
+			py::arg("coef"))
+		.def("add", py::overload_cast<std::shared_ptr<Field>, float, const Box3&>(&GridFusion::add),
+			py::arg("field"),
+			py::arg("coef"),
+			py::arg("support"))
+		.def("size", &GridFusion::size);
+
 	py::class_<Dist2ToPoint, std::shared_ptr<Dist2ToPoint>, Field>(m, "Dist2ToPoint")
 		.def(PYTMKS(Dist2ToPoint, const Vec3&),
 			py::arg("center"));
@@ -162,6 +218,35 @@ PYBIND11_MODULE(toumou, m)
 			py::arg("grid_size"),
 			py::arg("grid_resolution"));
 
+	py::class_<BakedField, std::shared_ptr<BakedField>, Field>(m, "BakedField")
+		.def(PYTMKS(BakedField, std::shared_ptr<Field>, const Box3&, float, float, int),
+			py::arg("field"),
+			py::arg("box"),
+			py::arg("voxel_size"),
+			py::arg("level") = 1.f,
+			py::arg("n_threads") = 0)
+		.def(PYTMKS(BakedField, const std::string&),
+			py::arg("path"))
+		.def("save", &BakedField::save,
+			py::arg("path"))
+		.def("n_dense_blocks", &BakedField::n_dense_blocks);
+
+	py::class_<Dual>(m, "Dual")
+		.def_readonly("value", &Dual::value)
+		.def_readonly("gradient", &Dual::gradient);
+
+	py::class_<FieldProgram>(m, "FieldProgram")
+		.def("value", &FieldProgram::value)
+		.def("value_and_gradient", &FieldProgram::value_and_gradient)
+		.def("value_batch", &value_batch<FieldProgram>,
+			py::arg("xs"),
+			py::arg("ys"),
+			py::arg("zs"))
+		.def("size", &FieldProgram::size);
+
+	m.def("compile", &compile,
+		py::arg("field"));
+
 	// Material
 
 	py::class_<Material>(m, "Material")
@@ -175,12 +260,29 @@ PYBIND11_MODULE(toumou, m)
 
 	// Root estimation
 
+	py::enum_<RootSearch>(m, "RootSearch")
+		.value("SAMPLING", RootSearch::Sampling)
+		.value("SPHERE_TRACING", RootSearch::SphereTracing)
+		.value("ISOLATION", RootSearch::Isolation);
+
+	py::class_<RootStatistics>(m, "RootStatistics")
+		.def_readonly("searches", &RootStatistics::searches)
+		.def_readonly("roots", &RootStatistics::roots)
+		.def_readonly("evaluations", &RootStatistics::evaluations)
+		.def_readonly("range_evaluations", &RootStatistics::range_evaluations)
+		.def_readonly("iterations", &RootStatistics::iterations)
+		.def_readonly("failures", &RootStatistics::failures)
+		.def_readonly("hint_misses", &RootStatistics::hint_misses);
+
 	py::class_<RootEstimator>(m, "RootEstimator")
 		.def_readwrite("t_min", &RootEstimator::t_min)
 		.def_readwrite("t_max", &RootEstimator::t_max)
 		.def_readwrite("sampling_step", &RootEstimator::sampling_step)
 		.def_readwrite("threshold", &RootEstimator::threshold)
-		.def_readwrite("max_iterations", &RootEstimator::max_iterations);
+		.def_readwrite("max_iterations", &RootEstimator::max_iterations)
+		.def_readwrite("search", &RootEstimator::search)
+		.def_readwrite("max_steps", &RootEstimator::max_steps)
+		.def_readwrite("footprint_scale", &RootEstimator::footprint_scale);
 
 	// Surface
 
@@ -206,7 +308,13 @@ PYBIND11_MODULE(toumou, m)
 	py::class_<ImplicitSurface, std::shared_ptr<ImplicitSurface>, Surface>(m, "ImplicitSurface")
 		.def(PYTMKS(ImplicitSurface, std::shared_ptr<Field>),
 			py::arg("field"))
-		.def_readwrite("root_estimator", &ImplicitSurface::root_estimator);
+		.def_readwrite("root_estimator", &ImplicitSurface::root_estimator)
+		.def_readwrite("bounding_box", &ImplicitSurface::bounding_box)
+		.def_readwrite("bounds_depth", &ImplicitSurface::bounds_depth)
+		.def_readwrite("occupancy_resolution", &ImplicitSurface::occupancy_resolution)
+		.def_readwrite("collect_statistics", &ImplicitSurface::collect_statistics)
+		.def("statistics", &ImplicitSurface::statistics)
+		.def("reset_statistics", &ImplicitSurface::reset_statistics);
 
 	// Scene
 
@@ -219,15 +327,44 @@ PYBIND11_MODULE(toumou, m)
 
 	// Rendering
 
+	py::enum_<Integrator>(m, "Integrator")
+		.value("BRANCHING", Integrator::Branching)
+		.value("PATH_TRACING", Integrator::PathTracing);
+
 	py::class_<RayTracer>(m, "RayTracer")
 		.def(py::init<int, int>())
 		.def_readwrite("pixel_sampling", &RayTracer::pixel_sampling)
 		.def_readwrite("max_bounce", &RayTracer::max_bounce)
 		.def_readwrite("rays_per_bounce", &RayTracer::rays_per_bounce)
 		.def_readwrite("env_sampling", &RayTracer::env_sampling)
+		.def_readwrite("adaptive_sampling", &RayTracer::adaptive_sampling)
+		.def_readwrite("min_pixel_sampling", &RayTracer::min_pixel_sampling)
+		.def_readwrite("noise_threshold", &RayTracer::noise_threshold)
+		.def_readwrite("diffuse_spread", &RayTracer::diffuse_spread)
+		.def_readwrite("integrator", &RayTracer::integrator)
+		.def_readwrite("roulette_bounce", &RayTracer::roulette_bounce)
+		.def_readwrite("n_threads", &RayTracer::n_threads)
+		.def_readwrite("tile_size", &RayTracer::tile_size)
+		.def_readwrite("hit_hints", &RayTracer::hit_hints)
+		.def_readwrite("seed", &RayTracer::seed)
 		.def("render", &RayTracer::render,
 			py::arg("scene"),
-			py::arg("progress_callback"));
+			py::arg("progress_callback"))
+		.def("render_pass", &RayTracer::render_pass,
+			py::arg("scene"),
+			py::arg("n_samples"),
+			py::arg("progress_callback"))
+		.def("reset", &RayTracer::reset);
+
+	// Kernel variants
+
+	py::enum_<InstructionSet>(m, "InstructionSet")
+		.value("BASELINE", InstructionSet::Baseline)
+		.value("SSE4", InstructionSet::SSE4)
+		.value("AVX2", InstructionSet::AVX2)
+		.value("AVX512", InstructionSet::AVX512);
+
+	m.def("dispatched_instruction_set", &dispatched_instruction_set);
 
 	// IO
 
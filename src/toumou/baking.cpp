@@ -0,0 +1,426 @@
+#include <toumou/baking.hpp>
+#include <toumou/field_compilation.hpp>
+#include <toumou/scheduling.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace toumou {
+
+namespace {
+
+/// Identifier at the start of baked field files.
+const char baked_magic[4] = { 'T', 'M', 'B', 'F' };
+
+/// Version of the baked field file format.
+const std::uint32_t baked_version = 1;
+
+/// Number of samples in a block.
+const int block_size = BakedField::block_nodes * BakedField::block_nodes * BakedField::block_nodes;
+
+/// Header of baked field files, followed by the block offsets, minimums and maximums and by the samples.
+struct BakedHeader {
+	char magic[4];
+	std::uint32_t version;
+	float origin[3];
+	float voxel_size;
+	float level;
+	std::int32_t n_blocks[3];
+	std::int32_t n_dense;
+};
+
+}
+
+BakedField::BakedField(std::shared_ptr<Field> field, const Box3& box, float voxel_size, float level, int n_threads) :
+	Field(),
+	m_origin(box.min), m_voxel_size(voxel_size), m_level(level), m_mapping_offset(0)
+{
+	const Vec3 size = box.size();
+	for (int axis = 0; axis < 3; ++axis) {
+		const int n_cells = std::max(1, static_cast<int>(std::ceil(size[axis] / voxel_size)));
+		m_n_blocks[axis] = (n_cells + block_cells - 1) / block_cells;
+	}
+	const int n = n_blocks();
+	m_offsets.assign(n, -1);
+	m_min.assign(n, 0.f);
+	m_max.assign(n, 0.f);
+
+	// Samples are evaluated block by block through the compiled field
+	const FieldProgram program = compile(field);
+	auto sample_block = [this, &program](int b, float* values) {
+		const int bi = b % m_n_blocks[0];
+		const int bj = (b / m_n_blocks[0]) % m_n_blocks[1];
+		const int bk = b / (m_n_blocks[0] * m_n_blocks[1]);
+		float xs[block_size], ys[block_size], zs[block_size];
+		for (int k = 0; k < block_nodes; ++k) {
+			for (int j = 0; j < block_nodes; ++j) {
+				for (int i = 0; i < block_nodes; ++i) {
+					const int idx = i + block_nodes * (j + block_nodes * k);
+					xs[idx] = m_origin.x + static_cast<float>(bi * block_cells + i) * m_voxel_size;
+					ys[idx] = m_origin.y + static_cast<float>(bj * block_cells + j) * m_voxel_size;
+					zs[idx] = m_origin.z + static_cast<float>(bk * block_cells + k) * m_voxel_size;
+				}
+			}
+		}
+		program.value_batch(xs, ys, zs, values, block_size);
+	};
+
+	// 1st pass: range of each block
+	parallel_for(n, n_threads, [this, &sample_block](int b) {
+		float values[block_size];
+		sample_block(b, values);
+		const auto [min, max] = std::minmax_element(values, values + block_size);
+		m_min[b] = *min;
+		m_max[b] = *max;
+	});
+
+	// Blocks crossing the level and their neighbours are stored
+	std::vector<char> dense(n, 0);
+	for (int bk = 0; bk < m_n_blocks[2]; ++bk) {
+		for (int bj = 0; bj < m_n_blocks[1]; ++bj) {
+			for (int bi = 0; bi < m_n_blocks[0]; ++bi) {
+				const int b = bi + m_n_blocks[0] * (bj + m_n_blocks[1] * bk);
+				if (m_min[b] > level || m_max[b] < level) {
+					continue;
+				}
+				for (int nk = std::max(0, bk - 1); nk <= std::min(m_n_blocks[2] - 1, bk + 1); ++nk) {
+					for (int nj = std::max(0, bj - 1); nj <= std::min(m_n_blocks[1] - 1, bj + 1); ++nj) {
+						for (int ni = std::max(0, bi - 1); ni <= std::min(m_n_blocks[0] - 1, bi + 1); ++ni) {
+							dense[ni + m_n_blocks[0] * (nj + m_n_blocks[1] * nk)] = 1;
+						}
+					}
+				}
+			}
+		}
+	}
+	std::vector<int> dense_blocks;
+	for (int b = 0; b < n; ++b) {
+		if (dense[b]) {
+			m_offsets[b] = static_cast<std::int32_t>(dense_blocks.size());
+			dense_blocks.push_back(b);
+		}
+	}
+
+	// 2nd pass: samples of the stored blocks
+	m_samples.resize(dense_blocks.size() * block_size);
+	parallel_for(static_cast<int>(dense_blocks.size()), n_threads, [this, &sample_block, &dense_blocks](int d) {
+		sample_block(dense_blocks[d], m_samples.data() + static_cast<std::size_t>(d) * block_size);
+	});
+	spdlog::info("baked field: {}x{}x{} blocks, {} stored", m_n_blocks[0], m_n_blocks[1], m_n_blocks[2], dense_blocks.size());
+}
+
+BakedField::BakedField(const std::string& path) :
+	Field(),
+	m_mapping_offset(0)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("cannot open baked field " + path);
+	}
+
+	BakedHeader header;
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file || std::memcmp(header.magic, baked_magic, sizeof(baked_magic)) != 0 || header.version != baked_version) {
+		throw std::runtime_error("invalid baked field " + path);
+	}
+	m_origin = Vec3(header.origin[0], header.origin[1], header.origin[2]);
+	m_voxel_size = header.voxel_size;
+	m_level = header.level;
+	if (!(m_voxel_size > 0.f) || !std::isfinite(m_voxel_size) || header.n_dense < 0) {
+		throw std::runtime_error("invalid baked field " + path);
+	}
+
+	// Block counts must be positive, and the numbers of voxels and of blocks must fit in an int
+	std::int64_t n_total = 1;
+	for (int axis = 0; axis < 3; ++axis) {
+		m_n_blocks[axis] = header.n_blocks[axis];
+		if (m_n_blocks[axis] <= 0 || m_n_blocks[axis] > std::numeric_limits<int>::max() / block_cells) {
+			throw std::runtime_error("invalid baked field " + path);
+		}
+		n_total *= m_n_blocks[axis];
+		if (n_total > std::numeric_limits<int>::max()) {
+			throw std::runtime_error("invalid baked field " + path);
+		}
+	}
+
+	const int n = n_blocks();
+	m_offsets.resize(n);
+	m_min.resize(n);
+	m_max.resize(n);
+	file.read(reinterpret_cast<char*>(m_offsets.data()), n * sizeof(std::int32_t));
+	file.read(reinterpret_cast<char*>(m_min.data()), n * sizeof(float));
+	file.read(reinterpret_cast<char*>(m_max.data()), n * sizeof(float));
+	if (!file) {
+		throw std::runtime_error("truncated baked field " + path);
+	}
+
+	// Offsets index the stored blocks, which would be read out of bounds otherwise
+	std::int32_t n_dense = 0;
+	for (std::int32_t offset : m_offsets) {
+		if (offset < -1 || offset >= header.n_dense) {
+			throw std::runtime_error("invalid baked field " + path);
+		}
+		n_dense += offset >= 0 ? 1 : 0;
+	}
+	if (n_dense != header.n_dense) {
+		throw std::runtime_error("invalid baked field " + path);
+	}
+
+	const std::size_t samples_offset = static_cast<std::size_t>(file.tellg());
+	const std::size_t samples_bytes = static_cast<std::size_t>(header.n_dense) * block_size * sizeof(float);
+
+#ifndef _WIN32
+	// Samples are mapped, pages are only read when rays reach them
+	file.close();
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd < 0 || ::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < samples_offset + samples_bytes) {
+		if (fd >= 0) {
+			::close(fd);
+		}
+		throw std::runtime_error("truncated baked field " + path);
+	}
+	const std::size_t length = static_cast<std::size_t>(st.st_size);
+	void* address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (address == MAP_FAILED) {
+		throw std::runtime_error("cannot map baked field " + path);
+	}
+	m_mapping = std::shared_ptr<const void>(address, [length](const void* p) {
+		::munmap(const_cast<void*>(p), length);
+	});
+	m_mapping_offset = samples_offset;
+#else
+	m_samples.resize(samples_bytes / sizeof(float));
+	file.read(reinterpret_cast<char*>(m_samples.data()), samples_bytes);
+	if (!file) {
+		throw std::runtime_error("truncated baked field " + path);
+	}
+#endif
+}
+
+void BakedField::save(const std::string& path) const
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("cannot write baked field " + path);
+	}
+
+	int n_dense = 0;
+	for (std::int32_t offset : m_offsets) {
+		n_dense += offset >= 0 ? 1 : 0;
+	}
+
+	BakedHeader header;
+	std::memcpy(header.magic, baked_magic, sizeof(baked_magic));
+	header.version = baked_version;
+	header.origin[0] = m_origin.x;
+	header.origin[1] = m_origin.y;
+	header.origin[2] = m_origin.z;
+	header.voxel_size = m_voxel_size;
+	header.level = m_level;
+	for (int axis = 0; axis < 3; ++axis) {
+		header.n_blocks[axis] = m_n_blocks[axis];
+	}
+	header.n_dense = n_dense;
+
+	const int n = n_blocks();
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(m_offsets.data()), n * sizeof(std::int32_t));
+	file.write(reinterpret_cast<const char*>(m_min.data()), n * sizeof(float));
+	file.write(reinterpret_cast<const char*>(m_max.data()), n * sizeof(float));
+	file.write(reinterpret_cast<const char*>(samples()), static_cast<std::size_t>(n_dense) * block_size * sizeof(float));
+	if (!file) {
+		throw std::runtime_error("cannot write baked field " + path);
+	}
+}
+
+int BakedField::n_dense_blocks() const
+{
+	return static_cast<int>(std::count_if(m_offsets.begin(), m_offsets.end(), [](std::int32_t offset) {
+		return offset >= 0;
+	}));
+}
+
+float BakedField::value(const Vec3& pos) const
+{
+	return interpolate(pos).value;
+}
+
+Vec3 BakedField::gradient(const Vec3& pos) const
+{
+	return interpolate(pos).gradient;
+}
+
+float BakedField::ray_derivative(const Ray& ray, float t) const
+{
+	return interpolate(ray.at(t)).gradient.dot(ray.dir);
+}
+
+Dual BakedField::value_and_gradient(const Vec3& pos) const
+{
+	return interpolate(pos);
+}
+
+float BakedField::value_and_ray_derivative(const Ray& ray, float t, float& derivative) const
+{
+	Dual out = interpolate(ray.at(t));
+	derivative = out.gradient.dot(ray.dir);
+	return out.value;
+}
+
+Box3 BakedField::superlevel_bounds(float level) const
+{
+	return blocks_bounds([level](float min, float max) {
+		return max >= level;
+	});
+}
+
+Box3 BakedField::sublevel_bounds(float level) const
+{
+	return blocks_bounds([level](float min, float max) {
+		return min <= level;
+	});
+}
+
+Interval BakedField::range(const Box3& box) const
+{
+	// Blocks covering the box, positions outside of the grid take the values of its border
+	int b_min[3], b_max[3];
+	const float block_length = m_voxel_size * static_cast<float>(block_cells);
+	for (int axis = 0; axis < 3; ++axis) {
+		const float n = static_cast<float>(m_n_blocks[axis]);
+		const float u_min = std::floor((box.min[axis] - m_origin[axis]) / block_length);
+		const float u_max = std::floor((box.max[axis] - m_origin[axis]) / block_length);
+		b_min[axis] = std::isnan(u_min) ? 0 : static_cast<int>(std::clamp(u_min, 0.f, n - 1.f));
+		b_max[axis] = std::isnan(u_max) ? static_cast<int>(n) - 1 : static_cast<int>(std::clamp(u_max, 0.f, n - 1.f));
+	}
+
+	// Interpolated values stay within the range of the samples
+	Interval out;
+	for (int bk = b_min[2]; bk <= b_max[2]; ++bk) {
+		for (int bj = b_min[1]; bj <= b_max[1]; ++bj) {
+			for (int bi = b_min[0]; bi <= b_max[0]; ++bi) {
+				const int b = bi + m_n_blocks[0] * (bj + m_n_blocks[1] * bk);
+				out.extendBy(Interval(m_min[b], m_max[b]));
+			}
+		}
+	}
+	return out;
+}
+
+const float* BakedField::samples() const
+{
+	if (m_mapping) {
+		return reinterpret_cast<const float*>(static_cast<const char*>(m_mapping.get()) + m_mapping_offset);
+	}
+	return m_samples.data();
+}
+
+int BakedField::n_blocks() const
+{
+	return m_n_blocks[0] * m_n_blocks[1] * m_n_blocks[2];
+}
+
+Box3 BakedField::block_box(int bi, int bj, int bk) const
+{
+	const float block_length = m_voxel_size * static_cast<float>(block_cells);
+	Vec3 min = m_origin + Vec3(static_cast<float>(bi), static_cast<float>(bj), static_cast<float>(bk)) * block_length;
+	return Box3(min, min + Vec3(block_length));
+}
+
+template<typename Predicate>
+Box3 BakedField::blocks_bounds(Predicate predicate) const
+{
+	Box3 box;
+	for (int bk = 0; bk < m_n_blocks[2]; ++bk) {
+		for (int bj = 0; bj < m_n_blocks[1]; ++bj) {
+			for (int bi = 0; bi < m_n_blocks[0]; ++bi) {
+				const int b = bi + m_n_blocks[0] * (bj + m_n_blocks[1] * bk);
+				if (!predicate(m_min[b], m_max[b])) {
+					continue;
+				}
+
+				// Values on the border extend outside of the grid
+				const bool border = bi == 0 || bj == 0 || bk == 0
+					|| bi == m_n_blocks[0] - 1 || bj == m_n_blocks[1] - 1 || bk == m_n_blocks[2] - 1;
+				if (border) {
+					return infinite_box();
+				}
+				box.extendBy(block_box(bi, bj, bk));
+			}
+		}
+	}
+	return box;
+}
+
+Dual BakedField::interpolate(const Vec3& pos) const
+{
+	// Position in voxels, clamped to the grid (NaN coordinates are moved to its origin)
+	int block[3], cell[3];
+	float frac[3];
+	bool inside[3];
+	for (int axis = 0; axis < 3; ++axis) {
+		const float n_cells = static_cast<float>(m_n_blocks[axis] * block_cells);
+		const float u = (pos[axis] - m_origin[axis]) / m_voxel_size;
+		const float clamped = std::isnan(u) ? 0.f : std::clamp(u, 0.f, n_cells);
+		inside[axis] = clamped == u;
+		block[axis] = std::min(static_cast<int>(clamped) / block_cells, m_n_blocks[axis] - 1);
+		const float local = clamped - static_cast<float>(block[axis] * block_cells);
+		cell[axis] = std::min(static_cast<int>(local), block_cells - 1);
+		frac[axis] = local - static_cast<float>(cell[axis]);
+	}
+
+	Dual out;
+	const int b = block[0] + m_n_blocks[0] * (block[1] + m_n_blocks[1] * block[2]);
+	const std::int32_t offset = m_offsets[b];
+	if (offset < 0) {
+		out.value = .5f * (m_min[b] + m_max[b]);
+		return out;
+	}
+
+	// Corners of the cell
+	const float* c = samples() + static_cast<std::size_t>(offset) * block_size
+		+ cell[0] + block_nodes * (cell[1] + block_nodes * cell[2]);
+	const int dj = block_nodes;
+	const int dk = block_nodes * block_nodes;
+	const float c000 = c[0], c100 = c[1], c010 = c[dj], c110 = c[dj + 1];
+	const float c001 = c[dk], c101 = c[dk + 1], c011 = c[dk + dj], c111 = c[dk + dj + 1];
+
+	// Trilinear interpolation and its partial derivatives
+	const float x = frac[0], y = frac[1], z = frac[2];
+	const float c00 = c000 + (c100 - c000) * x;
+	const float c10 = c010 + (c110 - c010) * x;
+	const float c01 = c001 + (c101 - c001) * x;
+	const float c11 = c011 + (c111 - c011) * x;
+	const float c0 = c00 + (c10 - c00) * y;
+	const float c1 = c01 + (c11 - c01) * y;
+	out.value = c0 + (c1 - c0) * z;
+
+	const float dx0 = (c100 - c000) + ((c110 - c010) - (c100 - c000)) * y;
+	const float dx1 = (c101 - c001) + ((c111 - c011) - (c101 - c001)) * y;
+	const float dy0 = c10 - c00;
+	const float dy1 = c11 - c01;
+	out.gradient = Vec3(
+		inside[0] ? (dx0 + (dx1 - dx0) * z) / m_voxel_size : 0.f,
+		inside[1] ? (dy0 + (dy1 - dy0) * z) / m_voxel_size : 0.f,
+		inside[2] ? (c1 - c0) / m_voxel_size : 0.f
+	);
+	return out;
+}
+
+}
@@ -0,0 +1,501 @@
+#include <toumou/bvh.hpp>
+#include <toumou/constants.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+
+namespace toumou {
+
+void BVH::update(const CommittedScene& scene)
+{
+	m_scene = &scene;
+	if (scene.surfaces != m_input) {
+		build();
+		return;
+	}
+
+	// Surfaces may have moved between bounded and unbounded since the last build
+	for (int s : m_bounded) {
+		if (!is_bounded(bounds(s))) {
+			build();
+			return;
+		}
+	}
+	for (int s : m_unbounded) {
+		if (is_bounded(bounds(s))) {
+			build();
+			return;
+		}
+	}
+
+	refit();
+}
+
+void BVH::build()
+{
+	m_input = m_scene->surfaces;
+	m_bounded.clear();
+	m_boxes.clear();
+	m_unbounded.clear();
+	m_nodes.clear();
+
+	// Sort out unbounded surfaces, planes and tubes are tested through the scene's arrays
+	for (int s = 0; s < static_cast<int>(m_input.size()); ++s) {
+		const SurfaceType type = m_scene->types[s];
+		if (type == SurfaceType::Plane || type == SurfaceType::Tube) {
+			continue;
+		}
+		Box3 box = bounds(s);
+		if (is_bounded(box)) {
+			m_bounded.push_back(s);
+			m_boxes.push_back(box);
+		}
+		else if (!box.isEmpty()) {
+			m_unbounded.push_back(s);
+		}
+	}
+
+	if (!m_bounded.empty()) {
+		m_nodes.push_back(Node());
+		build_node(0, 0, static_cast<int>(m_bounded.size()));
+	}
+}
+
+void BVH::build_node(int index, int begin, int end)
+{
+	// Bounds of the surfaces and of their centers
+	Box3 box;
+	Box3 centers;
+	for (int k = begin; k < end; ++k) {
+		box.extendBy(m_boxes[k]);
+		centers.extendBy(m_boxes[k].center());
+	}
+	m_nodes[index].box = box;
+
+	// Leaf
+	if (end - begin <= max_leaf_size) {
+		m_nodes[index].first = begin;
+		m_nodes[index].count = end - begin;
+		return;
+	}
+
+	// Median split along the axis with the largest spread of centers
+	const int axis = static_cast<int>(centers.majorAxis());
+	const int middle = (begin + end) / 2;
+	std::vector<int> order(end - begin);
+	std::iota(order.begin(), order.end(), begin);
+	std::nth_element(order.begin(), order.begin() + (middle - begin), order.end(), [&](int a, int b) {
+		return m_boxes[a].center()[axis] < m_boxes[b].center()[axis];
+	});
+
+	std::vector<int> surfaces(end - begin);
+	std::vector<Box3> boxes(end - begin);
+	for (int k = 0; k < end - begin; ++k) {
+		surfaces[k] = m_bounded[order[k]];
+		boxes[k] = m_boxes[order[k]];
+	}
+	std::copy(surfaces.begin(), surfaces.end(), m_bounded.begin() + begin);
+	std::copy(boxes.begin(), boxes.end(), m_boxes.begin() + begin);
+
+	// Children are stored next to each other
+	const int left = static_cast<int>(m_nodes.size());
+	m_nodes.push_back(Node());
+	m_nodes.push_back(Node());
+	m_nodes[index].first = left;
+	m_nodes[index].count = 0;
+
+	build_node(left, begin, middle);
+	build_node(left + 1, middle, end);
+}
+
+void BVH::refit()
+{
+	for (std::size_t k = 0; k < m_bounded.size(); ++k) {
+		m_boxes[k] = bounds(m_bounded[k]);
+	}
+
+	// Children are always stored after their parent
+	for (int index = static_cast<int>(m_nodes.size()) - 1; index >= 0; --index) {
+		Node& node = m_nodes[index];
+		Box3 box;
+		if (node.count > 0) {
+			for (int k = node.first; k < node.first + node.count; ++k) {
+				box.extendBy(m_boxes[k]);
+			}
+		}
+		else {
+			box.extendBy(m_nodes[node.first].box);
+			box.extendBy(m_nodes[node.first + 1].box);
+		}
+		node.box = box;
+	}
+}
+
+bool BVH::hit(const Ray& ray, HitRecord& record, const HitHint& hint) const
+{
+	int closest = -1;
+	float t_min = std::numeric_limits<float>::max();
+	Vec3 n_closest;
+
+	auto test = [&](int s) {
+		// Check if ray intersects surface
+		float t_local = 0.f;
+		Vec3 n_local;
+		if (!hit(s, ray, hint, t_local, n_local)) {
+			return;
+		}
+
+		// Make sure intersection point is not ray origin
+		if (t_local < eps_ray_sep) {
+			return;
+		}
+
+		// Update closest hit
+		if (closest < 0 || t_local < t_min) {
+			closest = s;
+			t_min = t_local;
+			n_closest = n_local;
+		}
+	};
+
+	// Unbounded surfaces first, they shorten the traversal
+	const PlaneArrays& planes = m_scene->planes;
+	for (int k = 0; k < planes.size(); ++k) {
+		float t_local = 0.f;
+		if (planes.hit(k, ray, t_local) && (closest < 0 || t_local < t_min)) {
+			closest = planes.surface[k];
+			t_min = t_local;
+		}
+	}
+	const TubeArrays& tubes = m_scene->tubes;
+	for (int k = 0; k < tubes.size(); ++k) {
+		float t_local = 0.f;
+		if (tubes.hit(k, ray, t_local) && (closest < 0 || t_local < t_min)) {
+			closest = tubes.surface[k];
+			t_min = t_local;
+		}
+	}
+	for (int s : m_unbounded) {
+		test(s);
+	}
+
+	// Tree traversal, closest child first
+	if (!m_nodes.empty()) {
+		const Vec3 inv_dir(1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z);
+		float t_enter = 0.f;
+		float t_exit = 0.f;
+
+		int stack[64];
+		int size = 0;
+		if (intersect(m_nodes[0].box, ray, inv_dir, t_enter, t_exit)) {
+			stack[size++] = 0;
+		}
+
+		while (size > 0) {
+			const Node& node = m_nodes[stack[--size]];
+
+			if (node.count > 0) {
+				for (int k = node.first; k < node.first + node.count; ++k) {
+					test(m_bounded[k]);
+				}
+				continue;
+			}
+
+			float t_left = 0.f;
+			float t_right = 0.f;
+			bool hit_left = intersect(m_nodes[node.first].box, ray, inv_dir, t_left, t_exit) && (closest < 0 || t_left < t_min);
+			bool hit_right = intersect(m_nodes[node.first + 1].box, ray, inv_dir, t_right, t_exit) && (closest < 0 || t_right < t_min);
+
+			if (hit_left && hit_right) {
+				// Push the farthest child first so that the closest is popped first
+				if (t_left < t_right) {
+					stack[size++] = node.first + 1;
+					stack[size++] = node.first;
+				}
+				else {
+					stack[size++] = node.first;
+					stack[size++] = node.first + 1;
+				}
+			}
+			else if (hit_left) {
+				stack[size++] = node.first;
+			}
+			else if (hit_right) {
+				stack[size++] = node.first + 1;
+			}
+		}
+	}
+
+	if (closest < 0) {
+		return false;
+	}
+
+	record_hit(closest, ray, t_min, n_closest, record);
+	return true;
+}
+
+void BVH::hit(const RayPacket& packet, HitRecord* records, HitHint* const* hints) const
+{
+	const int n = RayPacket::max_size;
+	float t_closest[n];
+	int closest[n];
+	for (int i = 0; i < n; ++i) {
+		t_closest[i] = std::numeric_limits<float>::max();
+		closest[i] = -1;
+	}
+
+	// Bounded surfaces without a packet test, they are tested ray by ray after the traversal with the unbounded ones
+	// (the list is reused by the packets of a thread so that tracing a packet allocates nothing)
+	thread_local std::vector<int> deferred;
+	deferred.clear();
+
+	// Unbounded surfaces first, they shorten the traversal
+	const PlaneArrays& planes = m_scene->planes;
+	for (int k = 0; k < planes.size(); ++k) {
+		planes.hit(k, packet, t_closest, closest);
+	}
+	const TubeArrays& tubes = m_scene->tubes;
+	for (int k = 0; k < tubes.size(); ++k) {
+		tubes.hit(k, packet, t_closest, closest);
+	}
+
+	// Tree traversal, a node is visited if any ray crosses it, closest child first
+	if (!m_nodes.empty()) {
+		float inv_x[n];
+		float inv_y[n];
+		float inv_z[n];
+		for (int i = 0; i < n; ++i) {
+			inv_x[i] = 1.f / packet.dir_x[i];
+			inv_y[i] = 1.f / packet.dir_y[i];
+			inv_z[i] = 1.f / packet.dir_z[i];
+		}
+		float t_enter = 0.f;
+
+		int stack[64];
+		int size = 0;
+		if (intersect(m_nodes[0].box, packet, inv_x, inv_y, inv_z, t_closest, t_enter)) {
+			stack[size++] = 0;
+		}
+
+		while (size > 0) {
+			const Node& node = m_nodes[stack[--size]];
+
+			if (node.count > 0) {
+				for (int k = node.first; k < node.first + node.count; ++k) {
+					const int s = m_bounded[k];
+					if (m_scene->types[s] == SurfaceType::Sphere) {
+						m_scene->spheres.hit(m_scene->type_indices[s], packet, t_closest, closest);
+					}
+					else {
+						deferred.push_back(s);
+					}
+				}
+				continue;
+			}
+
+			float t_left = 0.f;
+			float t_right = 0.f;
+			bool hit_left = intersect(m_nodes[node.first].box, packet, inv_x, inv_y, inv_z, t_closest, t_left);
+			bool hit_right = intersect(m_nodes[node.first + 1].box, packet, inv_x, inv_y, inv_z, t_closest, t_right);
+
+			if (hit_left && hit_right) {
+				// Push the farthest child first so that the closest is popped first
+				if (t_left < t_right) {
+					stack[size++] = node.first + 1;
+					stack[size++] = node.first;
+				}
+				else {
+					stack[size++] = node.first;
+					stack[size++] = node.first + 1;
+				}
+			}
+			else if (hit_left) {
+				stack[size++] = node.first;
+			}
+			else if (hit_right) {
+				stack[size++] = node.first + 1;
+			}
+		}
+	}
+
+	// Remaining surfaces, each ray passes its hit as a hint to the next rays sharing its hint
+	for (int i = 0; i < packet.size; ++i) {
+		const Ray ray = packet.ray(i);
+		HitHint* hint = hints ? hints[i] : nullptr;
+		Vec3 n_closest;
+		auto test = [&](int s) {
+			float t_local = 0.f;
+			Vec3 n_local;
+			if (!hit(s, ray, hint ? *hint : HitHint(), t_local, n_local) || t_local < eps_ray_sep) {
+				return;
+			}
+			if (closest[i] < 0 || t_local < t_closest[i]) {
+				closest[i] = s;
+				t_closest[i] = t_local;
+				n_closest = n_local;
+			}
+		};
+		for (int s : m_unbounded) {
+			test(s);
+		}
+		for (int s : deferred) {
+			test(s);
+		}
+
+		records[i] = HitRecord();
+		if (closest[i] >= 0) {
+			record_hit(closest[i], ray, t_closest[i], n_closest, records[i]);
+		}
+		if (hint) {
+			hint->surface = records[i].surface;
+			hint->t = records[i].t;
+		}
+	}
+}
+
+bool BVH::occluded(const Ray& ray, float t_max) const
+{
+	const PlaneArrays& planes = m_scene->planes;
+	for (int k = 0; k < planes.size(); ++k) {
+		if (planes.occluded(k, ray, t_max)) {
+			return true;
+		}
+	}
+	const TubeArrays& tubes = m_scene->tubes;
+	for (int k = 0; k < tubes.size(); ++k) {
+		if (tubes.occluded(k, ray, t_max)) {
+			return true;
+		}
+	}
+	for (int s : m_unbounded) {
+		if (occluded(s, ray, t_max)) {
+			return true;
+		}
+	}
+
+	if (m_nodes.empty()) {
+		return false;
+	}
+
+	// Tree traversal, stop at the first blocking surface
+	const Vec3 inv_dir(1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z);
+	float t_enter = 0.f;
+	float t_exit = 0.f;
+
+	int stack[64];
+	int size = 0;
+	stack[size++] = 0;
+
+	while (size > 0) {
+		const Node& node = m_nodes[stack[--size]];
+
+		if (!intersect(node.box, ray, inv_dir, t_enter, t_exit) || t_enter >= t_max) {
+			continue;
+		}
+
+		if (node.count > 0) {
+			for (int k = node.first; k < node.first + node.count; ++k) {
+				if (occluded(m_bounded[k], ray, t_max)) {
+					return true;
+				}
+			}
+			continue;
+		}
+
+		stack[size++] = node.first;
+		stack[size++] = node.first + 1;
+	}
+
+	return false;
+}
+
+Box3 BVH::bounds(int surface) const
+{
+	const int k = m_scene->type_indices[surface];
+	switch (m_scene->types[surface]) {
+	case SurfaceType::Sphere:
+		return m_scene->spheres.bounds(k);
+	case SurfaceType::Implicit:
+		return m_scene->implicit_surfaces[k]->ImplicitSurface::bounds();
+	case SurfaceType::Plane:
+	case SurfaceType::Tube:
+		return infinite_box();
+	default:
+		return m_scene->surfaces[surface]->bounds();
+	}
+}
+
+bool BVH::hit(int surface, const Ray& ray, const HitHint& hint, float& t, Vec3& normal) const
+{
+	const int k = m_scene->type_indices[surface];
+	switch (m_scene->types[surface]) {
+	case SurfaceType::Sphere:
+		return m_scene->spheres.hit(k, ray, t);
+	case SurfaceType::Plane:
+		return m_scene->planes.hit(k, ray, t);
+	case SurfaceType::Tube:
+		return m_scene->tubes.hit(k, ray, t);
+	case SurfaceType::Implicit: {
+		const ImplicitSurface* implicit = m_scene->implicit_surfaces[k];
+		if (implicit == hint.surface) {
+			return implicit->ImplicitSurface::hit_near(ray, hint.t, t, normal);
+		}
+		return implicit->ImplicitSurface::hit(ray, t, normal);
+	}
+	default: {
+		const Surface* other = m_scene->surfaces[surface].get();
+		if (other == hint.surface) {
+			return other->hit_near(ray, hint.t, t, normal);
+		}
+		return other->hit(ray, t, normal);
+	}
+	}
+}
+
+void BVH::record_hit(int surface, const Ray& ray, float t, const Vec3& normal, HitRecord& record) const
+{
+	record.index = surface;
+	record.surface = m_scene->surfaces[surface].get();
+	record.material = &m_scene->materials[surface];
+	record.t = t;
+	record.position = ray.at(t);
+	record.footprint = ray.footprint(t);
+
+	// Analytic surfaces only compute the normal of the closest hit
+	const SurfaceType type = m_scene->types[surface];
+	record.normal = type == SurfaceType::Implicit || type == SurfaceType::Other ? normal : this->normal(surface, record.position);
+}
+
+bool BVH::occluded(int surface, const Ray& ray, float t_max) const
+{
+	const int k = m_scene->type_indices[surface];
+	switch (m_scene->types[surface]) {
+	case SurfaceType::Sphere:
+		return m_scene->spheres.occluded(k, ray, t_max);
+	case SurfaceType::Plane:
+		return m_scene->planes.occluded(k, ray, t_max);
+	case SurfaceType::Tube:
+		return m_scene->tubes.occluded(k, ray, t_max);
+	case SurfaceType::Implicit:
+		return m_scene->implicit_surfaces[k]->ImplicitSurface::occluded(ray, t_max);
+	default:
+		return m_scene->surfaces[surface]->occluded(ray, t_max);
+	}
+}
+
+Vec3 BVH::normal(int surface, const Vec3& pos) const
+{
+	const int k = m_scene->type_indices[surface];
+	switch (m_scene->types[surface]) {
+	case SurfaceType::Sphere:
+		return m_scene->spheres.normal(k, pos);
+	case SurfaceType::Plane:
+		return m_scene->planes.normal(k);
+	default:
+		return m_scene->tubes.normal(k, pos);
+	}
+}
+
+}
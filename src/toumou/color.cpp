@@ -3,4 +3,9 @@
 
 namespace toumou {
 
+float intensity(const Color& color)
+{
+	return color.dot(Imath::V3f(1)) / 3.f;
+}
+
 }
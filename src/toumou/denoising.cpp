@@ -1,11 +1,33 @@
 #include <toumou/denoising.hpp>
+#include <toumou/dispatch.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <utility>
 #include <limits>
 
 
 namespace toumou {
 
+namespace {
+
+/// Sum of the distances between each color of a window and all the colors of the window, given channel by channel.
+TOUMOU_DISPATCH
+void window_distances(const float* reds, const float* greens, const float* blues, int n, float* distances)
+{
+	std::fill(distances, distances + n, 0.f);
+	for (int q = 0; q < n; ++q) {
+		for (int p = 0; p < n; ++p) {
+			const float dr = reds[p] - reds[q];
+			const float dg = greens[p] - greens[q];
+			const float db = blues[p] - blues[q];
+			distances[p] += std::sqrt(dr * dr + dg * dg + db * db);
+		}
+	}
+}
+
+}
+
 Image<Color> VMFDenoiser::denoise(const RayTracer& rt) const
 {
 	// Noisy color output of ray tracing
@@ -20,12 +42,24 @@ Image<Color> VMFDenoiser::denoise(const RayTracer& rt) const
 	// Filtered image
 	Image<Color> img(width, height);
 
+	// Pixel coordinates and colors in the local window, colors are stored channel by channel
+	std::vector<std::pair<int, int>> coordinates;
+	std::vector<float> reds, greens, blues, distances;
+	coordinates.reserve(window_area);
+	reds.reserve(window_area);
+	greens.reserve(window_area);
+	blues.reserve(window_area);
+	distances.resize(window_area);
+
 	for (int j = 0; j < width; ++j) {
 		for (int i = 0; i < height; ++i) {
 			// Vector median calculation in local window
 
-			// Retrieve coordinates of pixels in local window
-			std::vector<std::pair<int, int>> coordinates;
+			// Retrieve coordinates and colors of pixels in local window
+			coordinates.clear();
+			reds.clear();
+			greens.clear();
+			blues.clear();
 			for (int delta_j = -window_half_size; delta_j <= window_half_size; ++delta_j) {
 				int j_local = j + delta_j;
 				if (j_local < 0 || j_local >= width) continue;
@@ -35,23 +69,24 @@ Image<Color> VMFDenoiser::denoise(const RayTracer& rt) const
 					if (i_local < 0 || i_local >= height) continue;
 
 					coordinates.push_back(std::make_pair(i_local, j_local));
+					const Color c = noisy_map.at(i_local, j_local);
+					reds.push_back(c.x);
+					greens.push_back(c.y);
+					blues.push_back(c.z);
 				}
 			}
-			
+
 			// Compute distances between pixel values
 			// and retrieve the pixel that minimizes that distance
+			const int n = static_cast<int>(coordinates.size());
+			window_distances(reds.data(), greens.data(), blues.data(), n, distances.data());
+
 			std::pair<int, int> coords_min(i, j);
 			float dist_min = std::numeric_limits<float>::max();
-			for (const auto& p : coordinates) {
-				float dist = 0.f;
-
-				for (const auto& q : coordinates) {
-					dist += (noisy_map.at(p.first, p.second) - noisy_map.at(q.first, q.second)).length();
-				}
-
-				if (dist < dist_min) {
-					coords_min = p;
-					dist_min = dist;
+			for (int p = 0; p < n; ++p) {
+				if (distances[p] < dist_min) {
+					coords_min = coordinates[p];
+					dist_min = distances[p];
 				}
 			}
 
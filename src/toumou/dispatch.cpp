@@ -0,0 +1,38 @@
+#include <toumou/dispatch.hpp>
+
+
+namespace toumou {
+
+InstructionSet dispatched_instruction_set()
+{
+#if TOUMOU_DISPATCH_VARIANTS
+	// Same priorities as the variant selection of the loader
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return InstructionSet::AVX512;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		return InstructionSet::AVX2;
+	}
+	if (__builtin_cpu_supports("sse4.2")) {
+		return InstructionSet::SSE4;
+	}
+#endif
+	return InstructionSet::Baseline;
+}
+
+const char* instruction_set_name(InstructionSet instruction_set)
+{
+	switch (instruction_set) {
+	case InstructionSet::SSE4:
+		return "SSE4";
+	case InstructionSet::AVX2:
+		return "AVX2";
+	case InstructionSet::AVX512:
+		return "AVX-512";
+	default:
+		return "baseline";
+	}
+}
+
+}
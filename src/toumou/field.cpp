@@ -1,5 +1,7 @@
 #include <toumou/field.hpp>
 #include <toumou/constants.hpp>
+#include <toumou/dispatch.hpp>
+#include <toumou/field_compilation.hpp>
 
 #include <spdlog/spdlog.h>
 
@@ -11,10 +13,167 @@
 
 namespace toumou {
 
+namespace {
+
+/// Range of the products of an interval's values by a coefficient.
+Interval scaled(const Interval& interval, float coef)
+{
+	if (coef == 0.f) {
+		return Interval(0.f);
+	}
+	return coef > 0.f ? Interval(interval.min * coef, interval.max * coef) : Interval(interval.max * coef, interval.min * coef);
+}
+
+/// Range of the sums of two intervals' values.
+Interval sum(const Interval& a, const Interval& b)
+{
+	return Interval(a.min + b.min, a.max + b.max);
+}
+
+/// Add the values of a batch multiplied by a coefficient to the values of another batch.
+TOUMOU_DISPATCH
+void add_scaled_batch(const float* term, float coef, float* out, std::size_t n)
+{
+	for (std::size_t i = 0; i < n; ++i) {
+		out[i] += term[i] * coef;
+	}
+}
+
+/// Squared distances between positions and a point, see Dist2ToPoint.
+TOUMOU_DISPATCH
+void dist2_to_point_batch(const Vec3& center, const float* xs, const float* ys, const float* zs, float* out, std::size_t n)
+{
+	const float cx = center.x, cy = center.y, cz = center.z;
+	for (std::size_t i = 0; i < n; ++i) {
+		const float dx = xs[i] - cx;
+		const float dy = ys[i] - cy;
+		const float dz = zs[i] - cz;
+		out[i] = dx * dx + dy * dy + dz * dz;
+	}
+}
+
+/// Squared distances between positions and a line, see Dist2ToLine.
+TOUMOU_DISPATCH
+void dist2_to_line_batch(const Vec3& origin, const Vec3& direction, const float* xs, const float* ys, const float* zs, float* out, std::size_t n)
+{
+	const float ox = origin.x, oy = origin.y, oz = origin.z;
+	const float ux = direction.x, uy = direction.y, uz = direction.z;
+	for (std::size_t i = 0; i < n; ++i) {
+		const float dx = xs[i] - ox;
+		const float dy = ys[i] - oy;
+		const float dz = zs[i] - oz;
+		const float lambda = dx * ux + dy * uy + dz * uz;
+		out[i] = dx * dx + dy * dy + dz * dz - lambda * lambda;
+	}
+}
+
+/// Signed distances between positions and a plane, see SignedDistToPlane.
+TOUMOU_DISPATCH
+void signed_dist_to_plane_batch(const Vec3& origin, const Vec3& normal, const float* xs, const float* ys, const float* zs, float* out, std::size_t n)
+{
+	const float ox = origin.x, oy = origin.y, oz = origin.z;
+	const float nx = normal.x, ny = normal.y, nz = normal.z;
+	for (std::size_t i = 0; i < n; ++i) {
+		out[i] = nx * (xs[i] - ox) + ny * (ys[i] - oy) + nz * (zs[i] - oz);
+	}
+}
+
+/// Inverse remapping of a batch of values, see Inverse.
+TOUMOU_DISPATCH
+void inverse_batch(float radius, float* ts, std::size_t n)
+{
+	for (std::size_t i = 0; i < n; ++i) {
+		ts[i] = radius / std::max(eps_div_by_zero, ts[i]);
+	}
+}
+
+/// Exponential remapping of a batch of values, see Exponential.
+TOUMOU_DISPATCH
+void exponential_batch(float factor, float* ts, std::size_t n)
+{
+	for (std::size_t i = 0; i < n; ++i) {
+		ts[i] = std::exp(ts[i] * factor);
+	}
+}
+
+/// Smoothstep remapping of a batch of values, see Smoothstep.
+TOUMOU_DISPATCH
+void smoothstep_batch(float in_min, float in_max, float* ts, std::size_t n)
+{
+	// Clamping is applied on the interpolation parameter to keep the loop branchless
+	const float inv_width = 1.f / (in_max - in_min);
+	for (std::size_t i = 0; i < n; ++i) {
+		const float u = std::clamp((ts[i] - in_min) * inv_width, 0.f, 1.f);
+		ts[i] = u * u * (3.f - 2.f * u);
+	}
+}
+
+/// Cell noise values at positions, see CellNoise.
+TOUMOU_DISPATCH
+void cell_noise_batch(const Vec3* points, float grid_size, int res, const float* xs, const float* ys, const float* zs, float* out, std::size_t n)
+{
+	const float voxel_size = grid_size / static_cast<float>(res);
+
+	// Positions are processed in chunks, the inner loops run over the positions of a chunk
+	constexpr std::size_t chunk = 64;
+	int cell_i[chunk], cell_j[chunk], cell_k[chunk];
+	float min_dist2[chunk];
+
+	for (std::size_t start = 0; start < n; start += chunk) {
+		const std::size_t m = std::min(chunk, n - start);
+		const float* x = xs + start;
+		const float* y = ys + start;
+		const float* z = zs + start;
+
+		for (std::size_t i = 0; i < m; ++i) {
+			cell_i[i] = static_cast<int>(std::floor(x[i] / voxel_size));
+			cell_j[i] = static_cast<int>(std::floor(y[i] / voxel_size));
+			cell_k[i] = static_cast<int>(std::floor(z[i] / voxel_size));
+			min_dist2[i] = std::numeric_limits<float>::max();
+		}
+
+		for (int di = -1; di <= 1; ++di) {
+			for (int dj = -1; dj <= 1; ++dj) {
+				for (int dk = -1; dk <= 1; ++dk) {
+					for (std::size_t i = 0; i < m; ++i) {
+						const int corner_i = cell_i[i] + di;
+						const int corner_j = cell_j[i] + dj;
+						const int corner_k = cell_k[i] + dk;
+						const int wi = ((corner_i % res) + res) % res;
+						const int wj = ((corner_j % res) + res) % res;
+						const int wk = ((corner_k % res) + res) % res;
+						const Vec3& p = points[wi + (wj + wk * res) * res];
+
+						const float dx = x[i] - (static_cast<float>(corner_i) + p.x) * voxel_size;
+						const float dy = y[i] - (static_cast<float>(corner_j) + p.y) * voxel_size;
+						const float dz = z[i] - (static_cast<float>(corner_k) + p.z) * voxel_size;
+						min_dist2[i] = std::min(min_dist2[i], dx * dx + dy * dy + dz * dz);
+					}
+				}
+			}
+		}
+
+		// Square root is only taken once per position
+		const float scale = 1.f / (voxel_size * std::sqrt(3.f));
+		for (std::size_t i = 0; i < m; ++i) {
+			out[start + i] = std::sqrt(min_dist2[i]) * scale;
+		}
+	}
+}
+
+}
+
 Field::Field()
 {
 }
 
+void Field::value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const
+{
+	for (std::size_t i = 0; i < n; ++i) {
+		out[i] = value(Vec3(xs[i], ys[i], zs[i]));
+	}
+}
+
 Vec3 Field::gradient(const Vec3& pos) const
 {
 	Vec3 dx(derivation_step, 0, 0);
@@ -31,6 +190,83 @@ float Field::ray_derivative(const Ray& ray, float t) const
 	return (value(ray.at(t + derivation_step)) - value(ray.at(t - derivation_step))) / (2.f * derivation_step);
 }
 
+Dual Field::value_and_gradient(const Vec3& pos) const
+{
+	Dual out;
+	out.value = value(pos);
+	out.gradient = gradient(pos);
+	return out;
+}
+
+float Field::value_and_ray_derivative(const Ray& ray, float t, float& derivative) const
+{
+	derivative = ray_derivative(ray, t);
+	return value(ray.at(t));
+}
+
+Box3 Field::superlevel_bounds(float level) const
+{
+	return infinite_box();
+}
+
+Box3 Field::sublevel_bounds(float level) const
+{
+	return infinite_box();
+}
+
+float Field::lipschitz(const Vec3& center, float radius) const
+{
+	return std::numeric_limits<float>::infinity();
+}
+
+Interval Field::range(const Box3& box) const
+{
+	const Vec3 center = box.center();
+	const float radius = .5f * (box.max - box.min).length();
+	const float lambda = lipschitz(center, radius);
+	if (!std::isfinite(lambda) || !std::isfinite(radius)) {
+		return infinite_interval();
+	}
+
+	const float v = value(center);
+	return Interval(v - lambda * radius, v + lambda * radius);
+}
+
+Box3 Field::refine_superlevel_bounds(float level, const Box3& box, int depth) const
+{
+	if (range(box).max < level) {
+		return Box3();
+	}
+	if (depth <= 0) {
+		return box;
+	}
+
+	// Union of the octants' bounds
+	const Vec3 center = box.center();
+	Box3 bounds;
+	for (int octant = 0; octant < 8; ++octant) {
+		Box3 child = box;
+		for (int axis = 0; axis < 3; ++axis) {
+			if (octant & (1 << axis)) {
+				child.min[axis] = center[axis];
+			}
+			else {
+				child.max[axis] = center[axis];
+			}
+		}
+		bounds.extendBy(refine_superlevel_bounds(level, child, depth - 1));
+	}
+	return bounds;
+}
+
+int Field::emit(FieldCompiler& compiler) const
+{
+	FieldInstruction ins;
+	ins.op = FieldOp::Call;
+	ins.field = this;
+	return compiler.push(ins);
+}
+
 Fusion::Fusion() : 
 	Field()
 {
@@ -50,9 +286,19 @@ float Fusion::value(const Vec3& pos) const
 	return sum;
 }
 
+void Fusion::value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const
+{
+	std::fill(out, out + n, 0.f);
+	std::vector<float> term(n);
+	for (const auto& [field, coef] : m_fields) {
+		field->value_batch(xs, ys, zs, term.data(), n);
+		add_scaled_batch(term.data(), coef, out, n);
+	}
+}
+
 Vec3 Fusion::gradient(const Vec3& pos) const
 {
-	Vec3 sum;
+	Vec3 sum(0.f);
 	for (const auto& [field, coef] : m_fields) {
 		sum += field->gradient(pos) * coef;
 	}
@@ -68,6 +314,323 @@ float Fusion::ray_derivative(const Ray& ray, float t) const
 	return sum;
 }
 
+Dual Fusion::value_and_gradient(const Vec3& pos) const
+{
+	Dual sum;
+	for (const auto& [field, coef] : m_fields) {
+		Dual term = field->value_and_gradient(pos);
+		sum.value += term.value * coef;
+		sum.gradient += term.gradient * coef;
+	}
+	return sum;
+}
+
+float Fusion::value_and_ray_derivative(const Ray& ray, float t, float& derivative) const
+{
+	float sum = 0.f;
+	derivative = 0.f;
+	for (const auto& [field, coef] : m_fields) {
+		float term_derivative = 0.f;
+		sum += field->value_and_ray_derivative(ray, t, term_derivative) * coef;
+		derivative += term_derivative * coef;
+	}
+	return sum;
+}
+
+Box3 Fusion::superlevel_bounds(float level) const
+{
+	if (level <= 0.f || m_fields.empty()) {
+		return infinite_box();
+	}
+
+	// If a sum of n non-negative terms reaches the level, at least one term reaches level / n
+	const float n = static_cast<float>(m_fields.size());
+	Box3 box;
+	for (const auto& [field, coef] : m_fields) {
+		const bool non_negative = field->sublevel_bounds(-std::numeric_limits<float>::min()).isEmpty();
+		if (coef <= 0.f || !non_negative) {
+			return infinite_box();
+		}
+		box.extendBy(field->superlevel_bounds(level / (n * coef)));
+	}
+	return box;
+}
+
+float Fusion::lipschitz(const Vec3& center, float radius) const
+{
+	float sum = 0.f;
+	for (const auto& [field, coef] : m_fields) {
+		sum += field->lipschitz(center, radius) * std::abs(coef);
+	}
+	return sum;
+}
+
+Interval Fusion::range(const Box3& box) const
+{
+	Interval out(0.f);
+	for (const auto& [field, coef] : m_fields) {
+		out = sum(out, scaled(field->range(box), coef));
+	}
+	return out;
+}
+
+int Fusion::emit(FieldCompiler& compiler) const
+{
+	std::vector<std::pair<int, float>> terms;
+	for (const auto& [field, coef] : m_fields) {
+		terms.push_back(std::make_pair(compiler.compile(*field), coef));
+	}
+	return compiler.sum(terms, 0.f);
+}
+
+GridFusion::GridFusion(float cell_size, float cutoff) :
+	Field(),
+	m_cell_size(cell_size), m_cutoff(cutoff)
+{
+}
+
+void GridFusion::add(std::shared_ptr<Field> field, float coef)
+{
+	// Same requirements as the superlevel bounds of a fusion
+	const bool non_negative = field->sublevel_bounds(-std::numeric_limits<float>::min()).isEmpty();
+	if (coef <= 0.f || !non_negative) {
+		add(field, coef, infinite_box());
+		return;
+	}
+	add(field, coef, field->superlevel_bounds(m_cutoff / coef));
+}
+
+void GridFusion::add(std::shared_ptr<Field> field, float coef, const Box3& support)
+{
+	const int index = static_cast<int>(m_terms.size());
+	m_terms.push_back({ field, coef, support, false });
+	if (support.isEmpty()) {
+		return;
+	}
+
+	// Unbounded or very large terms are evaluated everywhere
+	int i_min = 0, j_min = 0, k_min = 0, i_max = 0, j_max = 0, k_max = 0;
+	if (is_bounded(support)) {
+		cell_of(support.min, i_min, j_min, k_min);
+		cell_of(support.max, i_max, j_max, k_max);
+	}
+	const double n_cells = static_cast<double>(i_max - i_min + 1) * (j_max - j_min + 1) * (k_max - k_min + 1);
+	if (!is_bounded(support) || n_cells > max_term_cells) {
+		m_terms.back().global = true;
+		m_global.push_back(index);
+		return;
+	}
+
+	for (int k = k_min; k <= k_max; ++k) {
+		for (int j = j_min; j <= j_max; ++j) {
+			for (int i = i_min; i <= i_max; ++i) {
+				m_cells[cell_key(i, j, k)].push_back(index);
+			}
+		}
+	}
+}
+
+int GridFusion::size() const
+{
+	return static_cast<int>(m_terms.size());
+}
+
+float GridFusion::value(const Vec3& pos) const
+{
+	float sum = 0.f;
+	for (int index : m_global) {
+		sum += m_terms[index].field->value(pos) * m_terms[index].coef;
+	}
+	if (const std::vector<int>* local = terms_at(pos)) {
+		for (int index : *local) {
+			const Term& term = m_terms[index];
+			if (term.support.intersects(pos)) {
+				sum += term.field->value(pos) * term.coef;
+			}
+		}
+	}
+	return sum;
+}
+
+Vec3 GridFusion::gradient(const Vec3& pos) const
+{
+	return value_and_gradient(pos).gradient;
+}
+
+float GridFusion::ray_derivative(const Ray& ray, float t) const
+{
+	float derivative = 0.f;
+	value_and_ray_derivative(ray, t, derivative);
+	return derivative;
+}
+
+Dual GridFusion::value_and_gradient(const Vec3& pos) const
+{
+	Dual sum;
+	auto accumulate = [&sum, &pos](const Term& term) {
+		Dual d = term.field->value_and_gradient(pos);
+		sum.value += d.value * term.coef;
+		sum.gradient += d.gradient * term.coef;
+	};
+	for (int index : m_global) {
+		accumulate(m_terms[index]);
+	}
+	if (const std::vector<int>* local = terms_at(pos)) {
+		for (int index : *local) {
+			if (m_terms[index].support.intersects(pos)) {
+				accumulate(m_terms[index]);
+			}
+		}
+	}
+	return sum;
+}
+
+float GridFusion::value_and_ray_derivative(const Ray& ray, float t, float& derivative) const
+{
+	const Vec3 pos = ray.at(t);
+	float sum = 0.f;
+	derivative = 0.f;
+	auto accumulate = [&](const Term& term) {
+		float term_derivative = 0.f;
+		sum += term.field->value_and_ray_derivative(ray, t, term_derivative) * term.coef;
+		derivative += term_derivative * term.coef;
+	};
+	for (int index : m_global) {
+		accumulate(m_terms[index]);
+	}
+	if (const std::vector<int>* local = terms_at(pos)) {
+		for (int index : *local) {
+			if (m_terms[index].support.intersects(pos)) {
+				accumulate(m_terms[index]);
+			}
+		}
+	}
+	return sum;
+}
+
+Box3 GridFusion::superlevel_bounds(float level) const
+{
+	// Outside of the terms' boxes the fusion is zero
+	if (level <= 0.f) {
+		return infinite_box();
+	}
+
+	Box3 box;
+	for (const Term& term : m_terms) {
+		if (!term.support.isEmpty() && !is_bounded(term.support)) {
+			return infinite_box();
+		}
+		box.extendBy(term.support);
+	}
+	return box;
+}
+
+float GridFusion::lipschitz(const Vec3& center, float radius) const
+{
+	float sum = 0.f;
+	for (int index : m_global) {
+		sum += m_terms[index].field->lipschitz(center, radius) * std::abs(m_terms[index].coef);
+	}
+	if (!std::isfinite(radius)) {
+		for (const Term& term : m_terms) {
+			if (!term.global) {
+				sum += term.field->lipschitz(center, radius) * std::abs(term.coef);
+			}
+		}
+		return sum;
+	}
+
+	// Terms whose box overlaps the ball
+	const Box3 ball(center - Vec3(radius), center + Vec3(radius));
+	for (int index : terms_in(ball)) {
+		const Term& term = m_terms[index];
+		if (!term.global && !intersection(term.support, ball).isEmpty()) {
+			sum += term.field->lipschitz(center, radius) * std::abs(term.coef);
+		}
+	}
+	return sum;
+}
+
+Interval GridFusion::range(const Box3& box) const
+{
+	Interval out(0.f);
+	for (int index : m_global) {
+		out = sum(out, scaled(m_terms[index].field->range(box), m_terms[index].coef));
+	}
+
+	for (int index : terms_in(box)) {
+		const Term& term = m_terms[index];
+		const Box3 overlap = intersection(term.support, box);
+		if (term.global || overlap.isEmpty()) {
+			continue;
+		}
+
+		// Outside of its box, the term does not contribute
+		Interval contribution = scaled(term.field->range(overlap), term.coef);
+		if (overlap != box) {
+			contribution.extendBy(0.f);
+		}
+		out = sum(out, contribution);
+	}
+	return out;
+}
+
+void GridFusion::cell_of(const Vec3& pos, int& i, int& j, int& k) const
+{
+	// Far away positions are clamped to the border cells, where the terms' boxes are checked anyway
+	const float limit = static_cast<float>(1 << 20);
+	i = static_cast<int>(std::clamp(std::floor(pos.x / m_cell_size), -limit, limit - 1.f));
+	j = static_cast<int>(std::clamp(std::floor(pos.y / m_cell_size), -limit, limit - 1.f));
+	k = static_cast<int>(std::clamp(std::floor(pos.z / m_cell_size), -limit, limit - 1.f));
+}
+
+std::vector<int> GridFusion::terms_in(const Box3& box) const
+{
+	int i_min, j_min, k_min, i_max, j_max, k_max;
+	cell_of(box.min, i_min, j_min, k_min);
+	cell_of(box.max, i_max, j_max, k_max);
+	std::vector<int> indices;
+	const double n_cells = static_cast<double>(i_max - i_min + 1) * (j_max - j_min + 1) * (k_max - k_min + 1);
+	if (n_cells > static_cast<double>(m_cells.size())) {
+		for (int index = 0; index < static_cast<int>(m_terms.size()); ++index) {
+			indices.push_back(index);
+		}
+		return indices;
+	}
+
+	for (int k = k_min; k <= k_max; ++k) {
+		for (int j = j_min; j <= j_max; ++j) {
+			for (int i = i_min; i <= i_max; ++i) {
+				auto it = m_cells.find(cell_key(i, j, k));
+				if (it != m_cells.end()) {
+					indices.insert(indices.end(), it->second.begin(), it->second.end());
+				}
+			}
+		}
+	}
+	std::sort(indices.begin(), indices.end());
+	indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+	return indices;
+}
+
+std::int64_t GridFusion::cell_key(int i, int j, int k)
+{
+	// 21 bits per coordinate
+	const std::int64_t mask = (std::int64_t(1) << 21) - 1;
+	return (std::int64_t(i) & mask) | ((std::int64_t(j) & mask) << 21) | ((std::int64_t(k) & mask) << 42);
+}
+
+const std::vector<int>* GridFusion::terms_at(const Vec3& pos) const
+{
+	if (m_cells.empty()) {
+		return nullptr;
+	}
+	int i, j, k;
+	cell_of(pos, i, j, k);
+	auto it = m_cells.find(cell_key(i, j, k));
+	return it == m_cells.end() ? nullptr : &it->second;
+}
+
 Dist2ToPoint::Dist2ToPoint(const Vec3& _center) : 
 	Field(),
 	center(_center)
@@ -79,6 +642,11 @@ float Dist2ToPoint::value(const Vec3& pos) const
 	return (pos - center).length2();
 }
 
+void Dist2ToPoint::value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const
+{
+	dist2_to_point_batch(center, xs, ys, zs, out, n);
+}
+
 Vec3 Dist2ToPoint::gradient(const Vec3& pos) const
 {
 	return (pos - center) * 2.f;
@@ -89,6 +657,58 @@ float Dist2ToPoint::ray_derivative(const Ray& ray, float t) const
 	return 2.f * (t + ray.dir.dot(ray.origin - center));
 }
 
+Dual Dist2ToPoint::value_and_gradient(const Vec3& pos) const
+{
+	Dual out;
+	out.value = (pos - center).length2();
+	out.gradient = (pos - center) * 2.f;
+	return out;
+}
+
+float Dist2ToPoint::value_and_ray_derivative(const Ray& ray, float t, float& derivative) const
+{
+	derivative = 2.f * (t + ray.dir.dot(ray.origin - center));
+	return (ray.at(t) - center).length2();
+}
+
+Box3 Dist2ToPoint::sublevel_bounds(float level) const
+{
+	if (level < 0.f) {
+		return Box3();
+	}
+	const float r = std::sqrt(level);
+	return Box3(center - Vec3(r), center + Vec3(r));
+}
+
+float Dist2ToPoint::lipschitz(const Vec3& center, float radius) const
+{
+	// Gradient norm is twice the distance to the point
+	return 2.f * ((center - this->center).length() + radius);
+}
+
+Interval Dist2ToPoint::range(const Box3& box) const
+{
+	float d2_min = 0.f;
+	float d2_max = 0.f;
+	for (int axis = 0; axis < 3; ++axis) {
+		const float below = box.min[axis] - center[axis];
+		const float above = center[axis] - box.max[axis];
+		const float closest = std::max(0.f, std::max(below, above));
+		const float farthest = std::max(std::abs(below), std::abs(above));
+		d2_min += closest * closest;
+		d2_max += farthest * farthest;
+	}
+	return Interval(d2_min, d2_max);
+}
+
+int Dist2ToPoint::emit(FieldCompiler& compiler) const
+{
+	FieldInstruction ins;
+	ins.op = FieldOp::Dist2ToPoint;
+	ins.p = { center.x, center.y, center.z };
+	return compiler.push(ins);
+}
+
 Dist2ToLine::Dist2ToLine(const Vec3& _origin, const Vec3& _direction) : 
 	Field(),
 	origin(_origin), direction(_direction)
@@ -102,6 +722,11 @@ float Dist2ToLine::value(const Vec3& pos) const
 	return delta.length2() - lambda * lambda;
 }
 
+void Dist2ToLine::value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const
+{
+	dist2_to_line_batch(origin, direction, xs, ys, zs, out, n);
+}
+
 Vec3 Dist2ToLine::gradient(const Vec3& pos) const
 {
 	Vec3 delta = pos - origin;
@@ -115,6 +740,74 @@ float Dist2ToLine::ray_derivative(const Ray& ray, float t) const
 	return (delta.dot(ray.dir) - ray.dir.dot(direction) * delta.dot(direction)) * 2.f;
 }
 
+Dual Dist2ToLine::value_and_gradient(const Vec3& pos) const
+{
+	Vec3 delta = pos - origin;
+	float lambda = delta.dot(direction);
+	Dual out;
+	out.value = delta.length2() - lambda * lambda;
+	out.gradient = (delta - direction * lambda) * 2.f;
+	return out;
+}
+
+float Dist2ToLine::value_and_ray_derivative(const Ray& ray, float t, float& derivative) const
+{
+	Vec3 delta = ray.at(t) - origin;
+	float lambda = delta.dot(direction);
+	derivative = (delta.dot(ray.dir) - ray.dir.dot(direction) * lambda) * 2.f;
+	return delta.length2() - lambda * lambda;
+}
+
+Box3 Dist2ToLine::sublevel_bounds(float level) const
+{
+	if (level < 0.f) {
+		return Box3();
+	}
+	return infinite_box();
+}
+
+float Dist2ToLine::lipschitz(const Vec3& center, float radius) const
+{
+	// Gradient norm is twice the distance to the line
+	Vec3 delta = center - origin;
+	float lambda = delta.dot(direction);
+	return 2.f * ((delta - direction * lambda).length() + radius);
+}
+
+Interval Dist2ToLine::range(const Box3& box) const
+{
+	// The offset to the line is linear in the position: its range along each axis is exact
+	float d2_min = 0.f;
+	for (int axis = 0; axis < 3; ++axis) {
+		Interval offset(-origin[axis] + direction[axis] * origin.dot(direction));
+		for (int k = 0; k < 3; ++k) {
+			const float coef = (axis == k ? 1.f : 0.f) - direction[axis] * direction[k];
+			offset = sum(offset, scaled(Interval(box.min[k], box.max[k]), coef));
+		}
+		const float closest = std::max(0.f, std::max(offset.min, -offset.max));
+		d2_min += closest * closest;
+	}
+
+	// The squared distance is convex: its maximum is reached at a corner
+	float d2_max = 0.f;
+	for (int corner = 0; corner < 8; ++corner) {
+		const Vec3 pos(
+			corner & 1 ? box.max.x : box.min.x,
+			corner & 2 ? box.max.y : box.min.y,
+			corner & 4 ? box.max.z : box.min.z);
+		d2_max = std::max(d2_max, value(pos));
+	}
+	return Interval(d2_min, d2_max);
+}
+
+int Dist2ToLine::emit(FieldCompiler& compiler) const
+{
+	FieldInstruction ins;
+	ins.op = FieldOp::Dist2ToLine;
+	ins.p = { origin.x, origin.y, origin.z, direction.x, direction.y, direction.z };
+	return compiler.push(ins);
+}
+
 SignedDistToPlane::SignedDistToPlane(const Vec3& _origin, const Vec3& _normal) :
 	Field(),
 	origin(_origin), normal(_normal)
@@ -126,6 +819,11 @@ float SignedDistToPlane::value(const Vec3& pos) const
 	return normal.dot(pos - origin);
 }
 
+void SignedDistToPlane::value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const
+{
+	signed_dist_to_plane_batch(origin, normal, xs, ys, zs, out, n);
+}
+
 Vec3 SignedDistToPlane::gradient(const Vec3& pos) const
 {
 	return normal;
@@ -136,6 +834,42 @@ float SignedDistToPlane::ray_derivative(const Ray& ray, float t) const
 	return ray.dir.dot(normal);
 }
 
+Dual SignedDistToPlane::value_and_gradient(const Vec3& pos) const
+{
+	Dual out;
+	out.value = normal.dot(pos - origin);
+	out.gradient = normal;
+	return out;
+}
+
+float SignedDistToPlane::value_and_ray_derivative(const Ray& ray, float t, float& derivative) const
+{
+	derivative = ray.dir.dot(normal);
+	return normal.dot(ray.at(t) - origin);
+}
+
+float SignedDistToPlane::lipschitz(const Vec3& center, float radius) const
+{
+	return normal.length();
+}
+
+Interval SignedDistToPlane::range(const Box3& box) const
+{
+	Interval out(-normal.dot(origin));
+	for (int axis = 0; axis < 3; ++axis) {
+		out = sum(out, scaled(Interval(box.min[axis], box.max[axis]), normal[axis]));
+	}
+	return out;
+}
+
+int SignedDistToPlane::emit(FieldCompiler& compiler) const
+{
+	FieldInstruction ins;
+	ins.op = FieldOp::SignedDistToPlane;
+	ins.p = { origin.x, origin.y, origin.z, normal.x, normal.y, normal.z };
+	return compiler.push(ins);
+}
+
 Remapping::Remapping(std::shared_ptr<Field> _field) : 
 	Field(),
 	input_field(_field)
@@ -147,19 +881,82 @@ float Remapping::derivative(float t) const
 	return (remap(t + derivation_step) - remap(t - derivation_step)) / (2.f * derivation_step);
 }
 
+void Remapping::remap_batch(float* ts, std::size_t n) const
+{
+	for (std::size_t i = 0; i < n; ++i) {
+		ts[i] = remap(ts[i]);
+	}
+}
+
 float Remapping::value(const Vec3& pos) const
 {
 	return remap(input_field->value(pos));
 }
 
+void Remapping::value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const
+{
+	input_field->value_batch(xs, ys, zs, out, n);
+	remap_batch(out, n);
+}
+
 Vec3 Remapping::gradient(const Vec3& pos) const
 {
-	return input_field->gradient(pos) * derivative(input_field->value(pos));
+	return value_and_gradient(pos).gradient;
 }
 
 float Remapping::ray_derivative(const Ray& ray, float t) const
 {
-	return input_field->ray_derivative(ray, t) * derivative(input_field->value(ray.at(t)));
+	float derivative = 0.f;
+	value_and_ray_derivative(ray, t, derivative);
+	return derivative;
+}
+
+Dual Remapping::value_and_gradient(const Vec3& pos) const
+{
+	Dual in = input_field->value_and_gradient(pos);
+	Dual out;
+	out.value = remap(in.value);
+	out.gradient = in.gradient * derivative(in.value);
+	return out;
+}
+
+float Remapping::value_and_ray_derivative(const Ray& ray, float t, float& derivative) const
+{
+	float in_derivative = 0.f;
+	const float in_value = input_field->value_and_ray_derivative(ray, t, in_derivative);
+	derivative = in_derivative * this->derivative(in_value);
+	return remap(in_value);
+}
+
+float Remapping::slope_bound(float t_min, float t_max) const
+{
+	return std::numeric_limits<float>::infinity();
+}
+
+Interval Remapping::remap_range(const Interval& t) const
+{
+	return infinite_interval();
+}
+
+float Remapping::lipschitz(const Vec3& center, float radius) const
+{
+	const float input_lipschitz = input_field->lipschitz(center, radius);
+	if (input_lipschitz == 0.f) {
+		return 0.f;
+	}
+	if (!std::isfinite(input_lipschitz)) {
+		return std::numeric_limits<float>::infinity();
+	}
+
+	// Range of the input field inside the ball
+	const float v = input_field->value(center);
+	const float delta = input_lipschitz * radius;
+	return slope_bound(v - delta, v + delta) * input_lipschitz;
+}
+
+Interval Remapping::range(const Box3& box) const
+{
+	return remap_range(input_field->range(box));
 }
 
 Inverse::Inverse(std::shared_ptr<Field> _field, float _radius) : 
@@ -174,12 +971,69 @@ float Inverse::remap(float t) const
 	return radius / d;
 }
 
+void Inverse::remap_batch(float* ts, std::size_t n) const
+{
+	inverse_batch(radius, ts, n);
+}
+
 float Inverse::derivative(float t) const
 {
 	float d = std::max(eps_div_by_zero, t * t);
 	return -radius / d;
 }
 
+Box3 Inverse::superlevel_bounds(float level) const
+{
+	if (radius <= 0.f || level <= 0.f) {
+		return infinite_box();
+	}
+
+	// radius / t >= level <=> t <= radius / level
+	const float t = radius / level;
+	if (t < eps_div_by_zero) {
+		return Box3();
+	}
+	return input_field->sublevel_bounds(t);
+}
+
+Box3 Inverse::sublevel_bounds(float level) const
+{
+	if (radius >= 0.f && level < 0.f) {
+		return Box3();
+	}
+	return infinite_box();
+}
+
+float Inverse::slope_bound(float t_min, float t_max) const
+{
+	// Slope decreases with the distance of the input to zero
+	float t2 = 0.f;
+	if (t_min > 0.f) {
+		t2 = t_min * t_min;
+	}
+	else if (t_max < 0.f) {
+		t2 = t_max * t_max;
+	}
+	return std::abs(radius) / std::max(eps_div_by_zero, t2);
+}
+
+Interval Inverse::remap_range(const Interval& t) const
+{
+	// Monotonic, decreasing for positive radii
+	const float a = remap(t.min);
+	const float b = remap(t.max);
+	return Interval(std::min(a, b), std::max(a, b));
+}
+
+int Inverse::emit(FieldCompiler& compiler) const
+{
+	FieldInstruction ins;
+	ins.op = FieldOp::Inverse;
+	ins.a = compiler.compile(*input_field);
+	ins.p[0] = radius;
+	return compiler.push(ins);
+}
+
 Exponential::Exponential(std::shared_ptr<Field> _field, float _factor) : 
 	Remapping(_field),
 	factor(_factor)
@@ -191,11 +1045,73 @@ float Exponential::remap(float t) const
 	return std::exp(t * factor);
 }
 
+void Exponential::remap_batch(float* ts, std::size_t n) const
+{
+	exponential_batch(factor, ts, n);
+}
+
 float Exponential::derivative(float t) const
 {
 	return std::exp(t * factor) * factor;
 }
 
+Box3 Exponential::superlevel_bounds(float level) const
+{
+	if (level <= 0.f) {
+		return infinite_box();
+	}
+
+	// exp(t * factor) >= level <=> t * factor >= log(level)
+	const float t = std::log(level);
+	if (factor > 0.f) {
+		return input_field->superlevel_bounds(t / factor);
+	}
+	else if (factor < 0.f) {
+		return input_field->sublevel_bounds(t / factor);
+	}
+	return t <= 0.f ? infinite_box() : Box3();
+}
+
+Box3 Exponential::sublevel_bounds(float level) const
+{
+	if (level <= 0.f) {
+		return Box3();
+	}
+
+	// exp(t * factor) <= level <=> t * factor <= log(level)
+	const float t = std::log(level);
+	if (factor > 0.f) {
+		return input_field->sublevel_bounds(t / factor);
+	}
+	else if (factor < 0.f) {
+		return input_field->superlevel_bounds(t / factor);
+	}
+	return t >= 0.f ? infinite_box() : Box3();
+}
+
+float Exponential::slope_bound(float t_min, float t_max) const
+{
+	// Slope is monotonic, maximum is reached at one end of the interval
+	return std::abs(factor) * std::max(std::exp(t_min * factor), std::exp(t_max * factor));
+}
+
+Interval Exponential::remap_range(const Interval& t) const
+{
+	// Monotonic, decreasing for negative factors
+	const float a = remap(t.min);
+	const float b = remap(t.max);
+	return Interval(std::min(a, b), std::max(a, b));
+}
+
+int Exponential::emit(FieldCompiler& compiler) const
+{
+	FieldInstruction ins;
+	ins.op = FieldOp::Exponential;
+	ins.a = compiler.compile(*input_field);
+	ins.p[0] = factor;
+	return compiler.push(ins);
+}
+
 Constant::Constant(float cst) :
 	Field(),
 	m_cst(cst)
@@ -207,9 +1123,14 @@ float Constant::value(const Vec3& pos) const
 	return m_cst;
 }
 
+void Constant::value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const
+{
+	std::fill(out, out + n, m_cst);
+}
+
 Vec3 Constant::gradient(const Vec3& pos) const
 {
-	return Vec3();
+	return Vec3(0.f);
 }
 
 float Constant::ray_derivative(const Ray& ray, float t) const
@@ -217,6 +1138,44 @@ float Constant::ray_derivative(const Ray& ray, float t) const
 	return 0.0f;
 }
 
+Dual Constant::value_and_gradient(const Vec3& pos) const
+{
+	Dual out;
+	out.value = m_cst;
+	return out;
+}
+
+float Constant::value_and_ray_derivative(const Ray& ray, float t, float& derivative) const
+{
+	derivative = 0.f;
+	return m_cst;
+}
+
+Box3 Constant::superlevel_bounds(float level) const
+{
+	return m_cst >= level ? infinite_box() : Box3();
+}
+
+Box3 Constant::sublevel_bounds(float level) const
+{
+	return m_cst <= level ? infinite_box() : Box3();
+}
+
+float Constant::lipschitz(const Vec3& center, float radius) const
+{
+	return 0.f;
+}
+
+Interval Constant::range(const Box3& box) const
+{
+	return Interval(m_cst);
+}
+
+int Constant::emit(FieldCompiler& compiler) const
+{
+	return compiler.constant(m_cst);
+}
+
 Smoothstep::Smoothstep(std::shared_ptr<Field> _field, float in_min, float in_max) :
 	Remapping(_field),
 	m_in_min(in_min), m_in_max(in_max)
@@ -238,6 +1197,11 @@ float Smoothstep::remap(float t) const
 	return u * u * (3.f - 2.f * u);
 }
 
+void Smoothstep::remap_batch(float* ts, std::size_t n) const
+{
+	smoothstep_batch(m_in_min, m_in_max, ts, n);
+}
+
 float Smoothstep::derivative(float t) const
 {
 	if (t < m_in_min || t > m_in_max) {
@@ -245,7 +1209,62 @@ float Smoothstep::derivative(float t) const
 	}
 
 	float u = (t - m_in_min) / (m_in_max - m_in_min);
-	return 6.f * u * (1.f - u);
+	return 6.f * u * (1.f - u) / (m_in_max - m_in_min);
+}
+
+Box3 Smoothstep::superlevel_bounds(float level) const
+{
+	if (level <= 0.f) {
+		return infinite_box();
+	}
+	if (level > 1.f) {
+		return Box3();
+	}
+
+	// Non-zero output requires the input to be above the lower edge
+	return input_field->superlevel_bounds(m_in_min);
+}
+
+Box3 Smoothstep::sublevel_bounds(float level) const
+{
+	if (level < 0.f) {
+		return Box3();
+	}
+	if (level >= 1.f) {
+		return infinite_box();
+	}
+
+	// Output lower than one requires the input to be below the upper edge
+	return input_field->sublevel_bounds(m_in_max);
+}
+
+float Smoothstep::slope_bound(float t_min, float t_max) const
+{
+	const float width = m_in_max - m_in_min;
+	if (t_max < m_in_min || t_min > m_in_max || width <= 0.f) {
+		return 0.f;
+	}
+
+	// Slope of the cubic is maximal at the middle of the input range, and symmetric around it
+	float u_min = std::clamp((t_min - m_in_min) / width, 0.f, 1.f);
+	float u_max = std::clamp((t_max - m_in_min) / width, 0.f, 1.f);
+	float u = (u_min <= .5f && u_max >= .5f) ? .5f : (std::abs(u_min - .5f) < std::abs(u_max - .5f) ? u_min : u_max);
+	return 6.f * u * (1.f - u) / width;
+}
+
+Interval Smoothstep::remap_range(const Interval& t) const
+{
+	return Interval(remap(t.min), remap(t.max));
+}
+
+int Smoothstep::emit(FieldCompiler& compiler) const
+{
+	FieldInstruction ins;
+	ins.op = FieldOp::Smoothstep;
+	ins.a = compiler.compile(*input_field);
+	ins.p[0] = m_in_min;
+	ins.p[1] = m_in_max;
+	return compiler.push(ins);
 }
 
 CellNoise::CellNoise(float grid_size, int grid_resolution) :
@@ -266,6 +1285,48 @@ CellNoise::CellNoise(float grid_size, int grid_resolution) :
 }
 
 float CellNoise::value(const Vec3& pos) const
+{
+	Vec3 point;
+	return closest_point(pos, point);
+}
+
+void CellNoise::value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const
+{
+	cell_noise_batch(m_points.data(), m_grid_size, m_grid_resolution, xs, ys, zs, out, n);
+}
+
+Vec3 CellNoise::gradient(const Vec3& pos) const
+{
+	return value_and_gradient(pos).gradient;
+}
+
+float CellNoise::ray_derivative(const Ray& ray, float t) const
+{
+	return gradient(ray.at(t)).dot(ray.dir);
+}
+
+Dual CellNoise::value_and_gradient(const Vec3& pos) const
+{
+	Vec3 point;
+	Dual out;
+	out.value = closest_point(pos, point);
+	if (out.value < eps_div_by_zero) {
+		return out;
+	}
+
+	const float voxel_size = m_grid_size / static_cast<float>(m_grid_resolution);
+	out.gradient = (pos - point).normalized() / (voxel_size * std::sqrt(3.f));
+	return out;
+}
+
+float CellNoise::value_and_ray_derivative(const Ray& ray, float t, float& derivative) const
+{
+	Dual out = value_and_gradient(ray.at(t));
+	derivative = out.gradient.dot(ray.dir);
+	return out.value;
+}
+
+float CellNoise::closest_point(const Vec3& pos, Vec3& point) const
 {
 	const float voxel_size = m_grid_size / static_cast<float>(m_grid_resolution);
 
@@ -290,10 +1351,13 @@ float CellNoise::value(const Vec3& pos) const
 				Vec3 corner(static_cast<float>(corner_i), static_cast<float>(corner_j), static_cast<float>(corner_k));
 
 				const int idx = i + (j + k * m_grid_resolution) * m_grid_resolution;
-				Vec3 point = (corner + m_points[idx]) * voxel_size;
+				Vec3 candidate = (corner + m_points[idx]) * voxel_size;
 
-				const float dist = (pos - point).length();
-				min_dist = std::min(min_dist, dist);
+				const float dist = (pos - candidate).length();
+				if (dist < min_dist) {
+					min_dist = dist;
+					point = candidate;
+				}
 			}
 		}
 	}
@@ -303,4 +1367,26 @@ float CellNoise::value(const Vec3& pos) const
 	return min_dist;
 }
 
+Box3 CellNoise::sublevel_bounds(float level) const
+{
+	if (level < 0.f) {
+		return Box3();
+	}
+	return infinite_box();
+}
+
+float CellNoise::lipschitz(const Vec3& center, float radius) const
+{
+	// Distance to the closest point is 1-Lipschitz
+	const float voxel_size = m_grid_size / static_cast<float>(m_grid_resolution);
+	return 1.f / (voxel_size * std::sqrt(3.f));
+}
+
+Interval CellNoise::range(const Box3& box) const
+{
+	Interval out = Field::range(box);
+	out.min = std::max(0.f, out.min);
+	return out;
+}
+
 }
@@ -0,0 +1,520 @@
+#include <toumou/field_compilation.hpp>
+#include <toumou/constants.hpp>
+#include <toumou/dispatch.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace toumou {
+
+namespace {
+
+/// Execute a single instruction, register operands are read from regs and Sum operands from operands.
+inline float execute(const FieldInstruction& ins, const float* regs, const std::pair<int, float>* operands, const Vec3& pos)
+{
+	const auto& p = ins.p;
+	switch (ins.op) {
+	case FieldOp::Constant:
+		return p[0];
+	case FieldOp::Dist2ToPoint:
+		return (pos - Vec3(p[0], p[1], p[2])).length2();
+	case FieldOp::Dist2ToLine: {
+		Vec3 delta = pos - Vec3(p[0], p[1], p[2]);
+		float lambda = delta.dot(Vec3(p[3], p[4], p[5]));
+		return delta.length2() - lambda * lambda;
+	}
+	case FieldOp::SignedDistToPlane:
+		return Vec3(p[3], p[4], p[5]).dot(pos - Vec3(p[0], p[1], p[2]));
+	case FieldOp::Affine:
+		return regs[ins.a] * p[0] + p[1];
+	case FieldOp::MulAdd:
+		return regs[ins.a] + regs[ins.b] * p[0];
+	case FieldOp::Sum: {
+		float sum = p[0];
+		for (int k = ins.a; k < ins.a + ins.b; ++k) {
+			sum += regs[operands[k].first] * operands[k].second;
+		}
+		return sum;
+	}
+	case FieldOp::Inverse:
+		return p[0] / std::max(eps_div_by_zero, regs[ins.a]);
+	case FieldOp::Exponential:
+		return std::exp(regs[ins.a] * p[0]);
+	case FieldOp::Smoothstep: {
+		float t = regs[ins.a];
+		if (t < p[0]) {
+			return 0.f;
+		}
+		else if (t > p[1]) {
+			return 1.f;
+		}
+		float u = (t - p[0]) / (p[1] - p[0]);
+		return u * u * (3.f - 2.f * u);
+	}
+	case FieldOp::InverseDist2ToPoint:
+		return p[3] / std::max(eps_div_by_zero, (pos - Vec3(p[0], p[1], p[2])).length2());
+	case FieldOp::ExponentialDist2ToPoint:
+		return std::exp((pos - Vec3(p[0], p[1], p[2])).length2() * p[3]);
+	case FieldOp::Call:
+		return ins.field->value(pos);
+	}
+	return 0.f;
+}
+
+/// Execute a single instruction on dual numbers, propagating the gradient with the chain rule.
+inline Dual execute_dual(const FieldInstruction& ins, const Dual* regs, const std::pair<int, float>* operands, const Vec3& pos)
+{
+	const auto& p = ins.p;
+	Dual out;
+	switch (ins.op) {
+	case FieldOp::Constant:
+		out.value = p[0];
+		break;
+	case FieldOp::Dist2ToPoint: {
+		Vec3 delta = pos - Vec3(p[0], p[1], p[2]);
+		out.value = delta.length2();
+		out.gradient = delta * 2.f;
+		break;
+	}
+	case FieldOp::Dist2ToLine: {
+		Vec3 direction(p[3], p[4], p[5]);
+		Vec3 delta = pos - Vec3(p[0], p[1], p[2]);
+		float lambda = delta.dot(direction);
+		out.value = delta.length2() - lambda * lambda;
+		out.gradient = (delta - direction * lambda) * 2.f;
+		break;
+	}
+	case FieldOp::SignedDistToPlane: {
+		Vec3 normal(p[3], p[4], p[5]);
+		out.value = normal.dot(pos - Vec3(p[0], p[1], p[2]));
+		out.gradient = normal;
+		break;
+	}
+	case FieldOp::Affine:
+		out.value = regs[ins.a].value * p[0] + p[1];
+		out.gradient = regs[ins.a].gradient * p[0];
+		break;
+	case FieldOp::MulAdd:
+		out.value = regs[ins.a].value + regs[ins.b].value * p[0];
+		out.gradient = regs[ins.a].gradient + regs[ins.b].gradient * p[0];
+		break;
+	case FieldOp::Sum:
+		out.value = p[0];
+		for (int k = ins.a; k < ins.a + ins.b; ++k) {
+			out.value += regs[operands[k].first].value * operands[k].second;
+			out.gradient += regs[operands[k].first].gradient * operands[k].second;
+		}
+		break;
+	case FieldOp::Inverse: {
+		const float t = regs[ins.a].value;
+		out.value = p[0] / std::max(eps_div_by_zero, t);
+		out.gradient = regs[ins.a].gradient * (-p[0] / std::max(eps_div_by_zero, t * t));
+		break;
+	}
+	case FieldOp::Exponential:
+		out.value = std::exp(regs[ins.a].value * p[0]);
+		out.gradient = regs[ins.a].gradient * (out.value * p[0]);
+		break;
+	case FieldOp::Smoothstep: {
+		const float t = regs[ins.a].value;
+		if (t < p[0]) {
+			out.value = 0.f;
+		}
+		else if (t > p[1]) {
+			out.value = 1.f;
+		}
+		else {
+			float u = (t - p[0]) / (p[1] - p[0]);
+			out.value = u * u * (3.f - 2.f * u);
+			out.gradient = regs[ins.a].gradient * (6.f * u * (1.f - u) / (p[1] - p[0]));
+		}
+		break;
+	}
+	case FieldOp::InverseDist2ToPoint: {
+		Vec3 delta = pos - Vec3(p[0], p[1], p[2]);
+		const float t = delta.length2();
+		out.value = p[3] / std::max(eps_div_by_zero, t);
+		out.gradient = delta * (-2.f * p[3] / std::max(eps_div_by_zero, t * t));
+		break;
+	}
+	case FieldOp::ExponentialDist2ToPoint: {
+		Vec3 delta = pos - Vec3(p[0], p[1], p[2]);
+		out.value = std::exp(delta.length2() * p[3]);
+		out.gradient = delta * (2.f * out.value * p[3]);
+		break;
+	}
+	case FieldOp::Call:
+		out = ins.field->value_and_gradient(pos);
+		break;
+	}
+	return out;
+}
+
+
+/// Execute a single instruction on m positions, register r holds its values at regs + r * stride.
+inline void execute_batch(const FieldInstruction& ins, const float* regs, std::size_t stride, const std::pair<int, float>* operands,
+						  const float* xs, const float* ys, const float* zs, float* out, std::size_t m)
+{
+	const auto& p = ins.p;
+	const float* a = ins.op != FieldOp::Sum && ins.a >= 0 ? regs + ins.a * stride : nullptr;
+	const float* b = ins.b >= 0 ? regs + ins.b * stride : nullptr;
+	switch (ins.op) {
+	case FieldOp::Constant:
+		std::fill(out, out + m, p[0]);
+		break;
+	case FieldOp::Dist2ToPoint:
+		for (std::size_t i = 0; i < m; ++i) {
+			const float dx = xs[i] - p[0], dy = ys[i] - p[1], dz = zs[i] - p[2];
+			out[i] = dx * dx + dy * dy + dz * dz;
+		}
+		break;
+	case FieldOp::Dist2ToLine:
+		for (std::size_t i = 0; i < m; ++i) {
+			const float dx = xs[i] - p[0], dy = ys[i] - p[1], dz = zs[i] - p[2];
+			const float lambda = dx * p[3] + dy * p[4] + dz * p[5];
+			out[i] = dx * dx + dy * dy + dz * dz - lambda * lambda;
+		}
+		break;
+	case FieldOp::SignedDistToPlane:
+		for (std::size_t i = 0; i < m; ++i) {
+			out[i] = p[3] * (xs[i] - p[0]) + p[4] * (ys[i] - p[1]) + p[5] * (zs[i] - p[2]);
+		}
+		break;
+	case FieldOp::Affine:
+		for (std::size_t i = 0; i < m; ++i) {
+			out[i] = a[i] * p[0] + p[1];
+		}
+		break;
+	case FieldOp::MulAdd:
+		for (std::size_t i = 0; i < m; ++i) {
+			out[i] = a[i] + b[i] * p[0];
+		}
+		break;
+	case FieldOp::Sum:
+		std::fill(out, out + m, p[0]);
+		for (int k = ins.a; k < ins.a + ins.b; ++k) {
+			const float* term = regs + operands[k].first * stride;
+			const float coef = operands[k].second;
+			for (std::size_t i = 0; i < m; ++i) {
+				out[i] += term[i] * coef;
+			}
+		}
+		break;
+	case FieldOp::Inverse:
+		for (std::size_t i = 0; i < m; ++i) {
+			out[i] = p[0] / std::max(eps_div_by_zero, a[i]);
+		}
+		break;
+	case FieldOp::Exponential:
+		for (std::size_t i = 0; i < m; ++i) {
+			out[i] = std::exp(a[i] * p[0]);
+		}
+		break;
+	case FieldOp::Smoothstep: {
+		const float inv_width = 1.f / (p[1] - p[0]);
+		for (std::size_t i = 0; i < m; ++i) {
+			const float u = std::clamp((a[i] - p[0]) * inv_width, 0.f, 1.f);
+			out[i] = u * u * (3.f - 2.f * u);
+		}
+		break;
+	}
+	case FieldOp::InverseDist2ToPoint:
+		for (std::size_t i = 0; i < m; ++i) {
+			const float dx = xs[i] - p[0], dy = ys[i] - p[1], dz = zs[i] - p[2];
+			out[i] = p[3] / std::max(eps_div_by_zero, dx * dx + dy * dy + dz * dz);
+		}
+		break;
+	case FieldOp::ExponentialDist2ToPoint:
+		for (std::size_t i = 0; i < m; ++i) {
+			const float dx = xs[i] - p[0], dy = ys[i] - p[1], dz = zs[i] - p[2];
+			out[i] = std::exp((dx * dx + dy * dy + dz * dz) * p[3]);
+		}
+		break;
+	case FieldOp::Call:
+		ins.field->value_batch(xs, ys, zs, out, m);
+		break;
+	}
+}
+}
+
+FieldProgram::FieldProgram() :
+	m_output(-1)
+{
+}
+
+float FieldProgram::value(const Vec3& pos) const
+{
+	// Empty program
+	const std::size_t n = m_instructions.size();
+	if (m_output < 0 || n == 0) {
+		return 0.f;
+	}
+
+	// Registers live on the stack for usual program sizes
+	float stack_regs[256];
+	std::vector<float> heap_regs;
+	float* regs = stack_regs;
+	if (n > 256) {
+		heap_regs.resize(n);
+		regs = heap_regs.data();
+	}
+
+	const FieldInstruction* instructions = m_instructions.data();
+	const std::pair<int, float>* operands = m_operands.data();
+	for (std::size_t i = 0; i < n; ++i) {
+		regs[i] = execute(instructions[i], regs, operands, pos);
+	}
+
+	return regs[m_output];
+}
+
+Dual FieldProgram::value_and_gradient(const Vec3& pos) const
+{
+	// Empty program
+	const std::size_t n = m_instructions.size();
+	if (m_output < 0 || n == 0) {
+		return Dual();
+	}
+
+	// Dual registers are initialized, keep the stack buffer small
+	Dual stack_regs[64];
+	std::vector<Dual> heap_regs;
+	Dual* regs = stack_regs;
+	if (n > 64) {
+		heap_regs.resize(n);
+		regs = heap_regs.data();
+	}
+
+	const FieldInstruction* instructions = m_instructions.data();
+	const std::pair<int, float>* operands = m_operands.data();
+	for (std::size_t i = 0; i < n; ++i) {
+		regs[i] = execute_dual(instructions[i], regs, operands, pos);
+	}
+
+	return regs[m_output];
+}
+
+TOUMOU_DISPATCH
+void FieldProgram::value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const
+{
+	// Empty program
+	const std::size_t n_regs = m_instructions.size();
+	if (m_output < 0 || n_regs == 0) {
+		std::fill(out, out + n, 0.f);
+		return;
+	}
+
+	// Registers of a chunk of positions live on the stack for usual program sizes
+	const std::size_t chunk = std::min<std::size_t>(n, 64);
+	float stack_regs[2048];
+	std::vector<float> heap_regs;
+	float* regs = stack_regs;
+	if (n_regs * chunk > 2048) {
+		heap_regs.resize(n_regs * chunk);
+		regs = heap_regs.data();
+	}
+
+	const FieldInstruction* instructions = m_instructions.data();
+	const std::pair<int, float>* operands = m_operands.data();
+	for (std::size_t start = 0; start < n; start += chunk) {
+		const std::size_t m = std::min(chunk, n - start);
+		for (std::size_t r = 0; r < n_regs; ++r) {
+			execute_batch(instructions[r], regs, chunk, operands, xs + start, ys + start, zs + start, regs + r * chunk, m);
+		}
+		std::copy(regs + m_output * chunk, regs + m_output * chunk + m, out + start);
+	}
+}
+
+bool FieldProgram::compiled_from(const Field* field) const
+{
+	return m_source && m_source.get() == field;
+}
+
+int FieldProgram::size() const
+{
+	return static_cast<int>(m_instructions.size());
+}
+
+int FieldCompiler::compile(const Field& field)
+{
+	auto it = m_visited.find(&field);
+	if (it != m_visited.end()) {
+		return it->second;
+	}
+
+	const int reg = field.emit(*this);
+	m_visited[&field] = reg;
+	return reg;
+}
+
+int FieldCompiler::push(const FieldInstruction& instruction)
+{
+	FieldInstruction ins = instruction;
+
+	// Constant folding
+	float va = 0.f;
+	float vb = 0.f;
+	const bool const_a = ins.a >= 0 && is_constant(ins.a, va);
+	const bool const_b = ins.b >= 0 && is_constant(ins.b, vb);
+	if (ins.op == FieldOp::MulAdd && const_a && const_b) {
+		return constant(va + vb * ins.p[0]);
+	}
+	else if (ins.op == FieldOp::MulAdd && const_b) {
+		ins = FieldInstruction{ FieldOp::Affine, ins.a, -1, { 1.f, vb * ins.p[0] } };
+	}
+	else if (ins.op == FieldOp::MulAdd && const_a) {
+		ins = FieldInstruction{ FieldOp::Affine, ins.b, -1, { ins.p[0], va } };
+	}
+	else if (ins.op != FieldOp::MulAdd && ins.a >= 0 && const_a) {
+		FieldInstruction local = ins;
+		local.a = 0;
+		return constant(execute(local, &va, nullptr, Vec3(0)));
+	}
+
+	// Fusion of remapped squared distances
+	if ((ins.op == FieldOp::Inverse || ins.op == FieldOp::Exponential) && m_instructions[ins.a].op == FieldOp::Dist2ToPoint) {
+		const auto& center = m_instructions[ins.a].p;
+		ins.op = ins.op == FieldOp::Inverse ? FieldOp::InverseDist2ToPoint : FieldOp::ExponentialDist2ToPoint;
+		ins.p = { center[0], center[1], center[2], ins.p[0] };
+		ins.a = -1;
+	}
+
+	// Identity
+	if (ins.op == FieldOp::Affine && ins.p[0] == 1.f && ins.p[1] == 0.f) {
+		return ins.a;
+	}
+
+	// Common subexpression elimination
+	auto key = std::make_tuple(static_cast<int>(ins.op), ins.a, ins.b, ins.p, ins.field);
+	auto it = m_registers.find(key);
+	if (it != m_registers.end()) {
+		return it->second;
+	}
+
+	const int reg = static_cast<int>(m_instructions.size());
+	m_instructions.push_back(ins);
+	m_registers[key] = reg;
+	return reg;
+}
+
+int FieldCompiler::sum(const std::vector<std::pair<int, float>>& terms, float offset)
+{
+	// Constant terms are moved to the offset
+	std::vector<std::pair<int, float>> operands;
+	for (const auto& [reg, coef] : terms) {
+		float cst = 0.f;
+		if (is_constant(reg, cst)) {
+			offset += cst * coef;
+		}
+		else if (coef != 0.f) {
+			operands.push_back(std::make_pair(reg, coef));
+		}
+	}
+
+	if (operands.empty()) {
+		return constant(offset);
+	}
+	if (operands.size() == 1) {
+		FieldInstruction ins;
+		ins.op = FieldOp::Affine;
+		ins.a = operands[0].first;
+		ins.p = { operands[0].second, offset };
+		return push(ins);
+	}
+
+	FieldInstruction ins;
+	ins.op = FieldOp::Sum;
+	ins.a = static_cast<int>(m_operands.size());
+	ins.b = static_cast<int>(operands.size());
+	ins.p[0] = offset;
+	m_operands.insert(m_operands.end(), operands.begin(), operands.end());
+
+	const int reg = static_cast<int>(m_instructions.size());
+	m_instructions.push_back(ins);
+	return reg;
+}
+
+int FieldCompiler::constant(float value)
+{
+	FieldInstruction ins;
+	ins.op = FieldOp::Constant;
+	ins.p[0] = value;
+	return push(ins);
+}
+
+bool FieldCompiler::is_constant(int reg, float& value) const
+{
+	const FieldInstruction& ins = m_instructions[reg];
+	if (ins.op != FieldOp::Constant) {
+		return false;
+	}
+	value = ins.p[0];
+	return true;
+}
+
+FieldProgram FieldCompiler::program(int output, std::shared_ptr<Field> source)
+{
+	// Dead code elimination: keep the instructions the output depends on
+	const int n = static_cast<int>(m_instructions.size());
+	std::vector<bool> live(n, false);
+	live[output] = true;
+	for (int i = output; i >= 0; --i) {
+		if (!live[i]) {
+			continue;
+		}
+		const FieldInstruction& ins = m_instructions[i];
+		if (ins.op == FieldOp::Sum) {
+			for (int k = ins.a; k < ins.a + ins.b; ++k) {
+				live[m_operands[k].first] = true;
+			}
+			continue;
+		}
+		if (ins.a >= 0) {
+			live[ins.a] = true;
+		}
+		if (ins.b >= 0) {
+			live[ins.b] = true;
+		}
+	}
+
+	// Compact the remaining instructions and renumber their registers
+	FieldProgram prog;
+	std::vector<int> renumber(n, -1);
+	for (int i = 0; i < n; ++i) {
+		if (!live[i]) {
+			continue;
+		}
+		FieldInstruction ins = m_instructions[i];
+		if (ins.op == FieldOp::Sum) {
+			const int start = static_cast<int>(prog.m_operands.size());
+			for (int k = ins.a; k < ins.a + ins.b; ++k) {
+				prog.m_operands.push_back(std::make_pair(renumber[m_operands[k].first], m_operands[k].second));
+			}
+			ins.a = start;
+		}
+		else {
+			if (ins.a >= 0) {
+				ins.a = renumber[ins.a];
+			}
+			if (ins.b >= 0) {
+				ins.b = renumber[ins.b];
+			}
+		}
+		renumber[i] = static_cast<int>(prog.m_instructions.size());
+		prog.m_instructions.push_back(ins);
+	}
+	prog.m_output = renumber[output];
+	prog.m_source = source;
+
+	return prog;
+}
+
+FieldProgram compile(std::shared_ptr<Field> field)
+{
+	FieldCompiler compiler;
+	const int output = compiler.compile(*field);
+	return compiler.program(output, field);
+}
+
+}
@@ -1,6 +1,9 @@
 #include <toumou/geometry.hpp>
+#include <toumou/dispatch.hpp>
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
 
 namespace toumou {
@@ -14,9 +17,127 @@ Vec3 Ray::at(float t) const
 	return origin + dir * t;
 }
 
+float Ray::footprint(float t) const
+{
+	return width + spread * t;
+}
+
+Ray RayPacket::ray(int k) const
+{
+	Ray ray(Vec3(origin_x[k], origin_y[k], origin_z[k]), Vec3(dir_x[k], dir_y[k], dir_z[k]));
+	ray.width = width[k];
+	ray.spread = spread[k];
+	return ray;
+}
+
 Ray trace(const Vec3& from, const Vec3& to)
 {
 	return Ray(from, (to - from).normalized());
 }
 
+Box3 infinite_box()
+{
+	Box3 box;
+	box.makeInfinite();
+	return box;
+}
+
+Interval infinite_interval()
+{
+	Interval interval;
+	interval.makeInfinite();
+	return interval;
+}
+
+Box3 segment_bounds(const Ray& ray, float t_start, float t_end)
+{
+	Box3 box(ray.at(t_start));
+	box.extendBy(ray.at(t_end));
+	return box;
+}
+
+bool is_bounded(const Box3& box)
+{
+	if (box.isEmpty()) {
+		return false;
+	}
+	const float inf = std::numeric_limits<float>::max();
+	for (int k = 0; k < 3; ++k) {
+		if (box.min[k] <= -inf || box.max[k] >= inf) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool is_bounded(const Interval& interval)
+{
+	if (interval.isEmpty()) {
+		return false;
+	}
+	const float inf = std::numeric_limits<float>::max();
+	return interval.min > -inf && interval.max < inf;
+}
+
+Box3 intersection(const Box3& a, const Box3& b)
+{
+	Box3 box;
+	for (int k = 0; k < 3; ++k) {
+		box.min[k] = std::max(a.min[k], b.min[k]);
+		box.max[k] = std::min(a.max[k], b.max[k]);
+	}
+	if (box.isEmpty()) {
+		box.makeEmpty();
+	}
+	return box;
+}
+
+bool intersect(const Box3& box, const Ray& ray, const Vec3& inv_dir, float& t_enter, float& t_exit)
+{
+	t_enter = 0.f;
+	t_exit = std::numeric_limits<float>::max();
+	for (int k = 0; k < 3; ++k) {
+		float t0 = (box.min[k] - ray.origin[k]) * inv_dir[k];
+		float t1 = (box.max[k] - ray.origin[k]) * inv_dir[k];
+		if (t0 > t1) {
+			std::swap(t0, t1);
+		}
+		// Comparisons are written so that NaNs (ray origin on a slab) do not shrink the range
+		t_enter = t0 > t_enter ? t0 : t_enter;
+		t_exit = t1 < t_exit ? t1 : t_exit;
+	}
+	return t_enter <= t_exit;
+}
+
+TOUMOU_DISPATCH
+bool intersect(const Box3& box, const RayPacket& packet, const float* inv_x, const float* inv_y, const float* inv_z, 
+			   const float* t_max, float& t_enter)
+{
+	// Same comparisons as the single ray version, written without branches so that lanes are processed together
+	auto slab = [](float min, float max, float origin, float inv, float& enter, float& exit) {
+		const float t0 = (min - origin) * inv;
+		const float t1 = (max - origin) * inv;
+		const float lo = t1 < t0 ? t1 : t0;
+		const float hi = t1 < t0 ? t0 : t1;
+		enter = lo > enter ? lo : enter;
+		exit = hi < exit ? hi : exit;
+	};
+
+	float closest = std::numeric_limits<float>::max();
+	int crossed = 0;
+	for (int k = 0; k < RayPacket::max_size; ++k) {
+		float enter = 0.f;
+		float exit = std::numeric_limits<float>::max();
+		slab(box.min.x, box.max.x, packet.origin_x[k], inv_x[k], enter, exit);
+		slab(box.min.y, box.max.y, packet.origin_y[k], inv_y[k], enter, exit);
+		slab(box.min.z, box.max.z, packet.origin_z[k], inv_z[k], enter, exit);
+		const bool crossing = enter <= exit && enter < t_max[k];
+		closest = crossing && enter < closest ? enter : closest;
+		crossed |= crossing;
+	}
+
+	t_enter = closest;
+	return crossed != 0;
+}
+
 }
@@ -30,6 +30,7 @@ void write_EXR(const RayTracer& rt, const std::string& path)
 	header.channels().insert("Normal.Z", Channel(IMF::FLOAT));
 	header.channels().insert("Depth", Channel(IMF::FLOAT));
 	header.channels().insert("Index", Channel(IMF::FLOAT));
+	header.channels().insert("Samples", Channel(IMF::FLOAT));
 
 	FrameBuffer buf;
 
@@ -113,6 +114,17 @@ void write_EXR(const RayTracer& rt, const std::string& path)
 		)
 	);
 
+	const float* pixels_samples = rt.sample_map.data();
+	buf.insert(
+		"Samples",
+		Slice(
+			IMF::FLOAT,
+			(char*) pixels_samples,
+			sizeof(float),
+			sizeof(float) * width
+		)
+	);
+
 	OutputFile file(path.c_str(), header);
 	file.setFrameBuffer(buf);
 	file.writePixels(height);
@@ -1,7 +1,6 @@
 #include <toumou/light.hpp>
 #include <toumou/constants.hpp>
 
-#include <limits>
 #include <cmath>
 #include <algorithm>
 
@@ -21,10 +20,7 @@ PointLight::PointLight(const Color& _color, float _brightness, const Vec3& _loca
 
 void PointLight::sample(const Vec3& pos, Vec3& dir, float& dist, float& intensity) const
 {
-	dir = (location - pos).normalized();
-	dist = (pos - location).length();
-	float dist2 = std::max(dist * dist, eps_div_by_zero);
-	intensity = brightness / dist2;
+	sample_point_light(location, brightness, pos, dir, dist, intensity);
 }
 
 DirectionalLight::DirectionalLight(const Color& _color, float _brightness, const Vec3& _direction) : 
@@ -35,9 +31,7 @@ DirectionalLight::DirectionalLight(const Color& _color, float _brightness, const
 
 void DirectionalLight::sample(const Vec3& pos, Vec3& dir, float& dist, float& intensity) const
 {
-	dir = direction;
-	dist = std::numeric_limits<float>::max();
-	intensity = brightness;
+	sample_directional_light(direction, brightness, pos, dir, dist, intensity);
 }
 
 EnvironmentLight::EnvironmentLight(const Color& _color, float _brightness) :
@@ -6,9 +6,9 @@ namespace toumou {
 Color Material::color_at(const Vec3& pos) const
 {
 	return Color(
-		red->value(pos),
-		green->value(pos),
-		blue->value(pos)
+		m_red_program.compiled_from(red.get()) ? m_red_program.value(pos) : red->value(pos),
+		m_green_program.compiled_from(green.get()) ? m_green_program.value(pos) : green->value(pos),
+		m_blue_program.compiled_from(blue.get()) ? m_blue_program.value(pos) : blue->value(pos)
 	);
 }
 
@@ -19,4 +19,11 @@ void Material::set_solid_color(const Color& color)
 	blue = tmks(Constant, color.z);
 }
 
+void Material::compile()
+{
+	m_red_program = toumou::compile(red);
+	m_green_program = toumou::compile(green);
+	m_blue_program = toumou::compile(blue);
+}
+
 }
@@ -0,0 +1,128 @@
+#include <toumou/occupancy.hpp>
+#include <toumou/scheduling.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+
+namespace toumou {
+
+OccupancyGrid::OccupancyGrid() :
+	m_source(nullptr), m_box(), m_cell_size(0.f), m_n_cells{ 0, 0, 0 }
+{
+}
+
+void OccupancyGrid::build(std::shared_ptr<Field> field, float level, const Box3& box, int resolution, int n_threads)
+{
+	m_source = field.get();
+	m_box = box;
+	const Vec3 size = box.size();
+	m_cell_size = std::max(size[box.majorAxis()], std::numeric_limits<float>::min()) / static_cast<float>(std::max(1, resolution));
+	for (int axis = 0; axis < 3; ++axis) {
+		m_n_cells[axis] = std::max(1, static_cast<int>(std::ceil(size[axis] / m_cell_size)));
+	}
+	const int n_slice = m_n_cells[0] * m_n_cells[1];
+	m_occupied.assign(static_cast<std::size_t>(n_slice) * m_n_cells[2], 0);
+
+	// A cell is empty if the field's range inside it stays below the level
+	parallel_for(m_n_cells[2], n_threads, [this, &field, level, n_slice](int k) {
+		std::uint8_t* occupied = m_occupied.data() + static_cast<std::size_t>(k) * n_slice;
+		for (int j = 0; j < m_n_cells[1]; ++j) {
+			for (int i = 0; i < m_n_cells[0]; ++i) {
+				const Vec3 min = m_box.min + Vec3(static_cast<float>(i), static_cast<float>(j), static_cast<float>(k)) * m_cell_size;
+				occupied[i + m_n_cells[0] * j] = field->range(Box3(min, min + Vec3(m_cell_size))).max >= level ? 1 : 0;
+			}
+		}
+	});
+
+	spdlog::info("occupancy grid: {}x{}x{} cells, {} occupied", m_n_cells[0], m_n_cells[1], m_n_cells[2], n_occupied());
+}
+
+bool OccupancyGrid::built_from(const Field* field) const
+{
+	return m_source != nullptr && m_source == field;
+}
+
+int OccupancyGrid::n_occupied() const
+{
+	return static_cast<int>(std::count(m_occupied.begin(), m_occupied.end(), 1));
+}
+
+bool OccupancyGrid::next_interval(const Ray& ray, float t_start, float t_end, float& t_enter, float& t_exit) const
+{
+	const Vec3 inv_dir(1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z);
+	float t_box_enter = 0.f;
+	float t_box_exit = 0.f;
+	if (!intersect(m_box, ray, inv_dir, t_box_enter, t_box_exit)) {
+		return false;
+	}
+	float t = std::max(t_box_enter, t_start);
+	t_box_exit = std::min(t_box_exit, t_end);
+	if (t >= t_box_exit) {
+		return false;
+	}
+
+	// Walk the cells crossed by the ray (3D DDA), starting with the one containing the entry point
+	const Vec3 entry = ray.at(t);
+	int cell[3], step[3];
+	float t_next[3], t_delta[3];
+	for (int axis = 0; axis < 3; ++axis) {
+		const int c = static_cast<int>(std::floor((entry[axis] - m_box.min[axis]) / m_cell_size));
+		cell[axis] = std::clamp(c, 0, m_n_cells[axis] - 1);
+		if (ray.dir[axis] > 0.f) {
+			step[axis] = 1;
+			t_next[axis] = (m_box.min[axis] + static_cast<float>(cell[axis] + 1) * m_cell_size - ray.origin[axis]) * inv_dir[axis];
+			t_delta[axis] = m_cell_size * inv_dir[axis];
+		}
+		else if (ray.dir[axis] < 0.f) {
+			step[axis] = -1;
+			t_next[axis] = (m_box.min[axis] + static_cast<float>(cell[axis]) * m_cell_size - ray.origin[axis]) * inv_dir[axis];
+			t_delta[axis] = -m_cell_size * inv_dir[axis];
+		}
+		else {
+			step[axis] = 0;
+			t_next[axis] = std::numeric_limits<float>::infinity();
+			t_delta[axis] = std::numeric_limits<float>::infinity();
+		}
+	}
+
+	bool found = false;
+	while (t < t_box_exit) {
+		int axis = t_next[0] < t_next[1] ? 0 : 1;
+		axis = t_next[2] < t_next[axis] ? 2 : axis;
+		const float t_cell_exit = std::min(t_next[axis], t_box_exit);
+
+		// Extend the current range of occupied cells, or stop at the first empty cell after it
+		// (cells left before t are only reached through rounding errors and are ignored)
+		const bool crossed = t_cell_exit > t;
+		if (crossed && occupied(cell)) {
+			if (!found) {
+				t_enter = t;
+				found = true;
+			}
+			t_exit = t_cell_exit;
+		}
+		else if (crossed && found) {
+			return true;
+		}
+
+		t = std::max(t, t_cell_exit);
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= m_n_cells[axis]) {
+			break;
+		}
+		t_next[axis] += t_delta[axis];
+	}
+
+	return found;
+}
+
+bool OccupancyGrid::occupied(const int cell[3]) const
+{
+	return m_occupied[cell[0] + m_n_cells[0] * (cell[1] + static_cast<std::size_t>(m_n_cells[1]) * cell[2])] != 0;
+}
+
+}
@@ -1,189 +1,195 @@
 #include <toumou/rendering.hpp>
 #include <toumou/constants.hpp>
+#include <toumou/dispatch.hpp>
 
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <limits>
+#include <mutex>
+#include <thread>
 
 
 namespace toumou {
 
 RayTracer::RayTracer(int w, int h) :
-	image(w, h), normal_map(w, h), depth_map(w, h), index_map(w, h),
-	m_dis(0.f, 1.f)
+	image(w, h), normal_map(w, h), depth_map(w, h), index_map(w, h), sample_map(w, h)
 {
-	std::random_device rd;
-	m_gen = std::mt19937(rd());
 }
 
-Ray RayTracer::cast(std::shared_ptr<Camera> camera, float x, float y, float aspect_ratio) const
+RayTracer::CameraFrame RayTracer::frame(const Camera& camera, float aspect_ratio, float pixel_width) const
 {
-	// Compute pixel position in 3D space
-	Vec3 pixel_pos = camera->location()
-		+ camera->forward() * camera->sensor_width / std::tan(.5f * camera->field_of_view)
-		- camera->left() * x * camera->sensor_width
-		+ camera->up() * y * camera->sensor_width * aspect_ratio;
-	return trace(camera->location(), pixel_pos);
+	CameraFrame frame;
+	frame.origin = camera.location();
+	frame.center = camera.forward() * camera.sensor_width / std::tan(.5f * camera.field_of_view);
+	frame.x_axis = camera.left() * -camera.sensor_width;
+	frame.y_axis = camera.up() * camera.sensor_width * aspect_ratio;
+	frame.spread = .5f * pixel_width * camera.sensor_width;
+	return frame;
 }
 
-Ray RayTracer::cast(const Vec3& pos, const Vec3& normal, float theta, float phi) const
+void RayTracer::cast(const CameraFrame& frame, const float* xs, const float* ys, RayPacket& packet) const
+{
+	for (int k = 0; k < RayPacket::max_size; ++k) {
+		// Pixel position relative to the camera's origin
+		const float px = frame.center.x + frame.x_axis.x * xs[k] + frame.y_axis.x * ys[k];
+		const float py = frame.center.y + frame.x_axis.y * xs[k] + frame.y_axis.y * ys[k];
+		const float pz = frame.center.z + frame.x_axis.z * xs[k] + frame.y_axis.z * ys[k];
+		const float inv_length = 1.f / std::max(std::sqrt(px * px + py * py + pz * pz), eps_div_by_zero);
+
+		packet.origin_x[k] = frame.origin.x;
+		packet.origin_y[k] = frame.origin.y;
+		packet.origin_z[k] = frame.origin.z;
+		packet.dir_x[k] = px * inv_length;
+		packet.dir_y[k] = py * inv_length;
+		packet.dir_z[k] = pz * inv_length;
+
+		// Cone through the pixel, starting from a point
+		packet.width[k] = 0.f;
+		packet.spread[k] = frame.spread * inv_length;
+	}
+}
+
+Ray RayTracer::cast(const Vec3& pos, const Vec3& normal, float theta, float phi, float footprint, float spread) const
 {
 	// Local coordinate system
 	Vec3 tz = (std::abs(normal.x) > std::abs(normal.y)) ? Vec3(normal.z, 0, -normal.x) : Vec3(0, -normal.z, normal.y);
 	tz.normalize();
 	Vec3 tx = normal.cross(tz);
 	Vec3 dir = tx * std::sin(theta) * std::cos(phi) + normal * std::cos(theta) + tz * std::sin(theta) * std::sin(phi);
-	return Ray(pos, dir);
+	Ray ray(pos, dir);
+	ray.width = footprint;
+	ray.spread = spread;
+	return ray;
 }
 
-std::shared_ptr<Surface> RayTracer::hit(const Ray& ray, const Scene& scene, float& t, Vec3& normal) const
+bool RayTracer::hit(const Ray& ray, HitRecord& record, const HitHint& hint) const
 {
-	std::shared_ptr<Surface> surface = nullptr;
-	float t_min = std::numeric_limits<float>::max();
+	return m_bvh.hit(ray, record, hint);
+}
 
-	// Go through all surfaces
-	for (const auto& s : scene.surfaces()) {
+bool RayTracer::occluded(const Ray& ray, float t_max) const
+{
+	return m_bvh.occluded(ray, t_max);
+}
 
-		// Check if ray intersects surface
-		float t_local = 0.f;
-		Vec3 n_local;
-		if (!s->hit(ray, t_local, n_local)) {
-			continue;
-		}
+Color RayTracer::direct_lighting(const HitRecord& record, const Vec3& dir_view, Sampler& sampler) const
+{
+	Color c_out(0);
 
-		// Make sure intersection point is not ray origin
-		if (t_local < eps_ray_sep) {
-			continue;
-		}
-		
-		// Update closest hit
-		if (!surface || (surface && t_local < t_min)) {
-			surface = s;
-			t_min = t_local;
-			normal = n_local;
+	// Add the contributions of the light rays that are not obstructed, only those are shaded
+	light_rays(record, dir_view, sampler, [&](const Ray& ray, float t_max, auto&& shade) {
+		if (!occluded(ray, t_max)) {
+			c_out += shade();
 		}
-	}
+	});
 
-	t = t_min;
-
-	return surface;
+	return c_out;
 }
 
-Color RayTracer::direct_lighting(std::shared_ptr<Surface> surface, const Scene& scene, const Vec3& pos, const Vec3& normal, const Vec3& dir_view) const
+template<typename Emit>
+void RayTracer::light_rays(const HitRecord& record, const Vec3& dir_view, Sampler& sampler, Emit&& emit) const
 {
-	Color c_out(0);
+	const Material& mat = *record.material;
+	const Vec3& pos = record.position;
+	const Vec3& normal = record.normal;
 
 	// Go through all light sources
-	for (const auto& light : scene.lights()) {
+	for (int k = 0; k < m_scene.n_lights(); ++k) {
 
 		// Retrieve light contribution
 		Vec3 dir_light;
 		float dist_light = 0.f;
 		float intensity = 0.f;
-		light->sample(pos, dir_light, dist_light, intensity);
+		Color light_color;
+		m_scene.sample_light(k, pos, dir_light, dist_light, intensity, light_color);
 
 		// Check if light direction belongs to local surface hemisphere
 		if (normal.dot(dir_light) < 0) {
 			continue;
 		}
 
-		// Check if light source is obstructed
 		Ray r_light(pos, dir_light);
-		float t_obstruct = 0.f;
-		Vec3 n_obstruct;
-		auto s_obstruct = hit(r_light, scene, t_obstruct, n_obstruct);
-		if (s_obstruct && t_obstruct < dist_light) {
-			continue;
-		}
-
-		// Diffuse
-		float diffuse = normal.dot(dir_light) * (surface->material).albedo / k_pi;
-		c_out += (surface->material).color_at(pos) * (diffuse * intensity);
-
-		// Specular
-		float specular = brdf(surface->material, dir_light, dir_view, normal) * (1.f - (surface->material).albedo);
-		c_out += light->color * (specular * intensity);
+		r_light.width = record.footprint;
+
+		emit(r_light, dist_light, [&]() {
+			// Diffuse
+			float diffuse = normal.dot(dir_light) * mat.albedo / k_pi;
+			Color contribution = mat.color_at(pos) * (diffuse * intensity);
+
+			// Specular
+			float specular = brdf(mat, dir_light, dir_view, normal) * (1.f - mat.albedo);
+			contribution += light_color * (specular * intensity);
+			return contribution;
+		});
 	}
 
 	// Environment lighting
-	auto env_light = scene.env_light();
+	const auto& env_light = m_scene.env_light;
 	if (!env_light) {
-		return c_out;
+		return;
 	}
 
-	Color c_env(0);
-
 	// Diffuse
 	for (int i = 0; i < env_sampling; ++i) {
 
 		// Generate ray in random direction
-		float r1 = m_dis(m_gen);
+		float r1 = sampler.next();
 		float theta = std::acos(1 - r1);
-		float r2 = m_dis(m_gen);
+		float r2 = sampler.next();
 		float phi = r2 * k_pi * 2.f;
-		Ray ray = cast(pos, normal, theta, phi);
+		Ray ray = cast(pos, normal, theta, phi, record.footprint, diffuse_spread);
 
 		// Check if light direction belongs to local surface hemisphere
 		if (normal.dot(ray.dir) < 0) {
 			continue;
 		}
 
-		// Check for surface intersection
-		float t_hit = 0.f;
-		Vec3 n_hit;
-		auto surf_hit = hit(ray, scene, t_hit, n_hit);
-		if (surf_hit) {
-			continue;
-		}
+		emit(ray, std::numeric_limits<float>::max(), [&]() {
+			Color c_sample(0);
+			float intensity;
+			env_light->sample(ray.dir, c_sample, intensity);
 
-		Color c_sample(0);
-		float intensity;
-		env_light->sample(ray.dir, c_sample, intensity);
-
-		float diffuse = normal.dot(ray.dir) * (surface->material).albedo / k_pi;
-		c_env += (surface->material).color_at(pos) * (diffuse * intensity) / static_cast<float>(env_sampling);
+			float diffuse = normal.dot(ray.dir) * mat.albedo / k_pi;
+			return Color(mat.color_at(pos) * (diffuse * intensity) / static_cast<float>(env_sampling));
+		});
 	}
 
 	// Specular
 	for (int i = 0; i < env_sampling; ++i) {
 
 		// Generate ray in random direction using GGX PDF
-		float r1 = m_dis(m_gen);
-		float theta = std::atan(surface->material.roughness * std::sqrt(r1 / (1.f - r1)));
-		float r2 = m_dis(m_gen);
+		float r1 = sampler.next();
+		float theta = std::atan(mat.roughness * std::sqrt(r1 / (1.f - r1)));
+		float r2 = sampler.next();
 		float phi = r2 * k_pi * 2.f;
 		Vec3 dir_reflected = 2.f * dir_view.dot(normal) * normal - dir_view;
-		Ray ray = cast(pos, dir_reflected, theta, phi);
+		Ray ray = cast(pos, dir_reflected, theta, phi, record.footprint, mat.roughness);
 
 		// Check if light direction belongs to local surface hemisphere
 		if (normal.dot(ray.dir) < 0) {
 			continue;
 		}
 
-		// Check for surface intersection
-		float t_hit = 0.f;
-		Vec3 n_hit;
-		auto surf_hit = hit(ray, scene, t_hit, n_hit);
-		if (surf_hit) {
-			continue;
-		}
+		emit(ray, std::numeric_limits<float>::max(), [&]() {
+			Color c_sample(0);
+			float intensity;
+			env_light->sample(ray.dir, c_sample, intensity);
 
-		Color c_sample(0);
-		float intensity;
-		env_light->sample(ray.dir, c_sample, intensity);
-
-		float specular = brdf(surface->material, ray.dir, dir_view, normal) * (1.f - (surface->material).albedo);
-		c_env += c_sample * (specular * intensity) / static_cast<float>(env_sampling);
+			float specular = brdf(mat, ray.dir, dir_view, normal) * (1.f - mat.albedo);
+			return Color(c_sample * (specular * intensity) / static_cast<float>(env_sampling));
+		});
 	}
-
-	c_out += c_env;
-
-	return c_out;
 }
 
-Color RayTracer::indirect_lighting(std::shared_ptr<Surface> surface, const Scene& scene, const Vec3& pos, const Vec3& normal, const Vec3& dir_view, int n_bounce) const
+Color RayTracer::indirect_lighting(const HitRecord& record, const Vec3& dir_view, int n_bounce, Sampler& sampler) const
 {
+	const Material& mat = *record.material;
+	const Vec3& pos = record.position;
+	const Vec3& normal = record.normal;
+
 	Color c_out(0);
 
 	// End of recursion
@@ -195,11 +201,11 @@ Color RayTracer::indirect_lighting(std::shared_ptr<Surface> surface, const Scene
 	for (int i = 0; i < rays_per_bounce; i++) {
 
 		// Generate ray in random direction
-		float r1 = m_dis(m_gen);
+		float r1 = sampler.next();
 		float theta = std::acos(1 - r1);
-		float r2 = m_dis(m_gen);
+		float r2 = sampler.next();
 		float phi = r2 * k_pi * 2.f;
-		Ray ray_bounce = cast(pos, normal, theta, phi);
+		Ray ray_bounce = cast(pos, normal, theta, phi, record.footprint, diffuse_spread);
 
 		// Check if light direction belongs to local surface hemisphere
 		if (normal.dot(ray_bounce.dir) < 0) {
@@ -207,37 +213,34 @@ Color RayTracer::indirect_lighting(std::shared_ptr<Surface> surface, const Scene
 		}
 
 		// Find first surface hit
-		float t_hit = 0.f;
-		Vec3 n_hit;
-		auto surf_hit = hit(ray_bounce, scene, t_hit, n_hit);
-		if (!surf_hit) {
+		HitRecord record_hit;
+		if (!hit(ray_bounce, record_hit)) {
 			continue;
 		}
 
-		Vec3 p_hit = ray_bounce.at(t_hit);
 		Vec3 dir_view_hit = ray_bounce.dir * -1;
 
 		// Direct lighting
-		Color c_direct = direct_lighting(surf_hit, scene, p_hit, n_hit, dir_view_hit);
+		Color c_direct = direct_lighting(record_hit, dir_view_hit, sampler);
 
 		// Recursive indirect lighting
-		Color c_indirect = indirect_lighting(surf_hit, scene, p_hit, n_hit, dir_view_hit, n_bounce - 1);
+		Color c_indirect = indirect_lighting(record_hit, dir_view_hit, n_bounce - 1, sampler);
 
 		// Diffuse
-		float diffuse = normal.dot(ray_bounce.dir) * (surface->material).albedo / k_pi;
-		float intensity = (c_direct + c_indirect).dot(Vec3(1)) / 3.f; // TODO: use luma formula instead
-		c_out += (surface->material).color_at(pos) * intensity * diffuse / static_cast<float>(rays_per_bounce);
+		float diffuse = normal.dot(ray_bounce.dir) * mat.albedo / k_pi;
+		float incoming_intensity = intensity(c_direct + c_indirect);
+		c_out += mat.color_at(pos) * incoming_intensity * diffuse / static_cast<float>(rays_per_bounce);
 	}
 
 	for (int i = 0; i < rays_per_bounce; i++) {
 
 		// Generate ray in random direction using GGX PDF
-		float r1 = m_dis(m_gen);
-		float theta = std::atan(surface->material.roughness * std::sqrt(r1 / (1.f - r1)));
-		float r2 = m_dis(m_gen);
+		float r1 = sampler.next();
+		float theta = std::atan(mat.roughness * std::sqrt(r1 / (1.f - r1)));
+		float r2 = sampler.next();
 		float phi = r2 * k_pi * 2.f;
 		Vec3 dir_reflected = 2.f * dir_view.dot(normal)* normal - dir_view;
-		Ray ray_bounce = cast(pos, dir_reflected, theta, phi);
+		Ray ray_bounce = cast(pos, dir_reflected, theta, phi, record.footprint, mat.roughness);
 
 		// Check if light direction belongs to local surface hemisphere
 		if (normal.dot(ray_bounce.dir) < 0) {
@@ -245,30 +248,121 @@ Color RayTracer::indirect_lighting(std::shared_ptr<Surface> surface, const Scene
 		}
 
 		// Find first surface hit
-		float t_hit = 0.f;
-		Vec3 n_hit;
-		auto surf_hit = hit(ray_bounce, scene, t_hit, n_hit);
-		if (!surf_hit) {
+		HitRecord record_hit;
+		if (!hit(ray_bounce, record_hit)) {
 			continue;
 		}
 
-		Vec3 p_hit = ray_bounce.at(t_hit);
 		Vec3 dir_view_hit = ray_bounce.dir * -1;
 
 		// Direct lighting
-		Color c_direct = direct_lighting(surf_hit, scene, p_hit, n_hit, dir_view_hit);
+		Color c_direct = direct_lighting(record_hit, dir_view_hit, sampler);
 
 		// Recursive indirect lighting
-		Color c_indirect = indirect_lighting(surf_hit, scene, p_hit, n_hit, dir_view_hit, n_bounce - 1);
+		Color c_indirect = indirect_lighting(record_hit, dir_view_hit, n_bounce - 1, sampler);
 
 		// Specular
-		float specular = brdf(surface->material, ray_bounce.dir, dir_view, normal) * (1.f - (surface->material).albedo);
+		float specular = brdf(mat, ray_bounce.dir, dir_view, normal) * (1.f - mat.albedo);
 		c_out += (c_direct + c_indirect) * specular / static_cast<float>(rays_per_bounce);
 	}
 
 	return c_out;
 }
 
+Color RayTracer::path_lighting(const HitRecord& record, const Vec3& dir_view, Sampler& sampler) const
+{
+	Color c_out(0);
+
+	// Product of the BRDF weights along the path
+	Color throughput(1);
+
+	// Current path vertex
+	HitRecord vertex = record;
+	Vec3 v = dir_view;
+
+	for (int bounce = 1; bounce <= max_bounce; ++bounce) {
+		Ray ray_bounce(vertex.position, vertex.normal);
+		if (!scatter(vertex, v, bounce, sampler, throughput, ray_bounce)) {
+			break;
+		}
+
+		// Find first surface hit, and move to next path vertex
+		if (!hit(ray_bounce, vertex)) {
+			break;
+		}
+		v = ray_bounce.dir * -1;
+
+		// Direct lighting
+		c_out += throughput * direct_lighting(vertex, v, sampler);
+	}
+
+	return c_out;
+}
+
+bool RayTracer::scatter(const HitRecord& vertex, const Vec3& dir_view, int bounce, Sampler& sampler, Color& throughput, Ray& ray) const
+{
+	sampler.start_bounce(bounce);
+
+	const Material& mat = *vertex.material;
+	const Vec3 p = vertex.position;
+	const Vec3 n = vertex.normal;
+	const Vec3& v = dir_view;
+	const float w = vertex.footprint;
+	const Color base_color = mat.color_at(p);
+
+	// Choose between diffuse and specular scattering proportionally to their weights
+	const float w_diffuse = mat.albedo * intensity(base_color);
+	const float w_specular = 1.f - mat.albedo;
+	if (w_diffuse + w_specular <= 0.f) {
+		return false;
+	}
+	const float p_diffuse = w_diffuse / (w_diffuse + w_specular);
+
+	float r0 = sampler.next();
+	float r1 = sampler.next();
+	float r2 = sampler.next();
+	float phi = r2 * k_pi * 2.f;
+
+	Color weight(0);
+	if (r0 < p_diffuse) {
+		// Generate ray in random direction
+		float theta = std::acos(1 - r1);
+		ray = cast(p, n, theta, phi, w, diffuse_spread);
+
+		// Diffuse
+		float diffuse = n.dot(ray.dir) * mat.albedo / k_pi;
+		weight = base_color * (diffuse / p_diffuse);
+	}
+	else {
+		// Generate ray in random direction using GGX PDF
+		float theta = std::atan(mat.roughness * std::sqrt(r1 / (1.f - r1)));
+		Vec3 dir_reflected = 2.f * v.dot(n) * n - v;
+		ray = cast(p, dir_reflected, theta, phi, w, mat.roughness);
+
+		// Specular
+		float specular = brdf(mat, ray.dir, v, n) * (1.f - mat.albedo);
+		weight = Color(specular / (1.f - p_diffuse));
+	}
+
+	// Check if light direction belongs to local surface hemisphere
+	if (n.dot(ray.dir) < 0) {
+		return false;
+	}
+
+	throughput *= weight;
+
+	// Russian roulette, survival probability follows the path throughput
+	if (bounce > roulette_bounce) {
+		float q = std::min(1.f, std::max({ throughput.x, throughput.y, throughput.z }));
+		if (sampler.next() >= q) {
+			return false;
+		}
+		throughput /= q;
+	}
+
+	return true;
+}
+
 float RayTracer::brdf(const Material& mat, const Vec3& dir_light, const Vec3& dir_view, const Vec3& normal) const
 {
 	// Half-angle vector
@@ -296,99 +390,314 @@ float RayTracer::brdf(const Material& mat, const Vec3& dir_light, const Vec3& di
 	return (ggx * fresnel * shadowing) / std::max(4.f * vn * ln, eps_div_by_zero);
 }
 
-void RayTracer::render(const Scene& scene, std::function<void(int)> progress_callback)
+void RayTracer::render_tile(const Tile& tile, int n_samples)
 {
-	// Start timer
-	spdlog::info("start rendering");
-	auto time_start = std::chrono::steady_clock::now();
-
-	// Dimensions
-	const int width = image.width();
-	const int height = image.height();
-	spdlog::info("dimensions: {}x{}", width, height);
+	const Camera& camera = *m_scene.camera;
 
 	// Aspect ratio
-	const float f_width = static_cast<float>(width);
-	const float f_height = static_cast<float>(height);
+	const float f_width = static_cast<float>(image.width());
+	const float f_height = static_cast<float>(image.height());
 	const float aspect_ratio = f_height / f_width;
+	const CameraFrame camera_frame = frame(camera, aspect_ratio, 1.f / f_width);
+
+	// Pixel states of the tile, pixels that have already converged take no sample in this pass
+	std::vector<PixelState*> pixels;
+	pixels.reserve(tile.area());
+	for (int j = tile.j_min; j < tile.j_max; j++) {
+		for (int i = tile.i_min; i < tile.i_max; i++) {
+			PixelState& pixel = m_pixels[i * image.width() + j];
+			pixel.hint = HitHint();
+			pixel.pass_end = pixel.n_samples + n_samples;
+			pixel.active = n_samples > 0 && !(adaptive_sampling && converged(pixel));
+			pixels.push_back(&pixel);
+		}
+	}
 
-	// First progress callback
-	int progress = 0;
-	progress_callback(0);
+	// Colors of the samples of a round
+	std::vector<Color> colors;
 
-	// Loop over pixels
-	for (int j = 0; j < width; j++) {
-		for (int i = 0; i < height; i++) {
-			// Pixel color (to compute)
-			Color c_out(0);
-
-			Vec3 n_out(0);
-			float depth_min = (scene.camera())->z_far;
-			float uid_out = 0.f;
-
-			// Pixel top-left coordinates
-			const float x = (static_cast<float>(j) / f_width) - .5f;
-			const float y = .5f - (static_cast<float>(i) / f_height);
-
-			// Send rays randomly over the pixel's area
-			for (int k = 0; k < pixel_sampling; k++) {
-
-				// Generate ray with a random offset
-				const float dx = m_dis(m_gen) / f_width;
-				const float dy = m_dis(m_gen) / f_height;
-				const Ray ray = cast(scene.camera(), x + dx, y + dy, aspect_ratio);
-
-				// Find first surface hit by ray
-				float t = 0.f;
-				Vec3 normal;
-				auto surface = hit(ray, scene, t, normal);
-				if (!surface) {
-					// No surface hit, send next ray
-					continue;
-				}
+	// Samples are taken in rounds, adaptive sampling only keeps the noisy pixels from one round to the next
+	while (true) {
+		int n_slots = 0;
+		for (PixelState* p : pixels) {
+			PixelState& pixel = *p;
+			if (!pixel.active) {
+				continue;
+			}
+			int n_round = n_samples;
+			if (adaptive_sampling) {
+				n_round = pixel.n_samples < min_pixel_sampling ? min_pixel_sampling - pixel.n_samples : RayPacket::max_size;
+			}
+			pixel.first_slot = n_slots;
+			pixel.n_slots = std::min(n_round, pixel.pass_end - pixel.n_samples);
+			n_slots += pixel.n_slots;
+		}
+		if (n_slots == 0) {
+			break;
+		}
+		colors.assign(n_slots, Color(0));
+		trace_samples(camera_frame, pixels, colors);
+
+		// Add the samples to the pixel estimates, in the order of the samples
+		for (PixelState* p : pixels) {
+			PixelState& pixel = *p;
+			if (!pixel.active) {
+				continue;
+			}
+			for (int slot = pixel.first_slot; slot < pixel.first_slot + pixel.n_slots; ++slot) {
+				const Color& c_sample = colors[slot];
+				pixel.color_sum += c_sample;
+				pixel.n_samples++;
+
+				const float sample_intensity = intensity(c_sample);
+				const float delta = sample_intensity - pixel.mean;
+				pixel.mean += delta / static_cast<float>(pixel.n_samples);
+				pixel.m2 += delta * (sample_intensity - pixel.mean);
+			}
+			pixel.active = pixel.n_samples < pixel.pass_end && !(adaptive_sampling && converged(pixel));
+		}
+	}
 
-				n_out += normal;
+	// Store the current estimates
+	for (const PixelState* p : pixels) {
+		const PixelState& pixel = *p;
+		const Color c_out = pixel.n_samples > 0 ? pixel.color_sum / static_cast<float>(pixel.n_samples) : Color(0);
+		image.set(pixel.i, pixel.j, c_out);
 
-				if (t < depth_min) {
-					depth_min = t;
-					uid_out = static_cast<float>(surface->uid());
-				}
+		normal_map.set(pixel.i, pixel.j, pixel.normal_sum.normalized());
+		depth_map.set(pixel.i, pixel.j, pixel.depth);
+		index_map.set(pixel.i, pixel.j, pixel.uid);
+		sample_map.set(pixel.i, pixel.j, static_cast<float>(pixel.n_samples));
+	}
+}
+
+void RayTracer::trace_samples(const CameraFrame& frame, const std::vector<PixelState*>& pixels, std::vector<Color>& colors) const
+{
+	// The samples of the active pixels are traced in packets one after the other, 
+	// so that the pixels taking fewer samples than a packet share their packets with their neighbours
+	PixelState* lane_pixels[RayPacket::max_size];
+	int lane_samples[RayPacket::max_size];
+	int n_lanes = 0;
+	for (PixelState* pixel : pixels) {
+		if (!pixel->active) {
+			continue;
+		}
+		for (int k = pixel->n_samples; k < pixel->n_samples + pixel->n_slots; ++k) {
+			lane_pixels[n_lanes] = pixel;
+			lane_samples[n_lanes] = k;
+			if (++n_lanes == RayPacket::max_size) {
+				trace_packet(frame, lane_pixels, lane_samples, n_lanes, colors);
+				n_lanes = 0;
+			}
+		}
+	}
+	if (n_lanes > 0) {
+		trace_packet(frame, lane_pixels, lane_samples, n_lanes, colors);
+	}
+}
 
-				// Hit position
-				Vec3 pos = ray.at(t);
+void RayTracer::trace_packet(const CameraFrame& frame, PixelState* const* pixels, const int* samples, int n, std::vector<Color>& colors) const
+{
+	const float f_width = static_cast<float>(image.width());
+	const float f_height = static_cast<float>(image.height());
+
+	// Generate rays with random offsets over their pixels' areas, the lanes after the last sample repeat it
+	float xs[RayPacket::max_size];
+	float ys[RayPacket::max_size];
+	HitHint* hints[RayPacket::max_size];
+	for (int l = 0; l < RayPacket::max_size; ++l) {
+		PixelState& pixel = *pixels[std::min(l, n - 1)];
+		const auto k = static_cast<std::uint32_t>(samples[std::min(l, n - 1)]);
+
+		// Pixel top-left coordinates
+		const float x = (static_cast<float>(pixel.j) / f_width) - .5f;
+		const float y = .5f - (static_cast<float>(pixel.i) / f_height);
+
+		xs[l] = x + pixel.sampler.get(k, 0, 0) / f_width;
+		ys[l] = y + pixel.sampler.get(k, 0, 1) / f_height;
+		hints[l] = &pixel.hint;
+	}
+	RayPacket packet;
+	cast(frame, xs, ys, packet);
+	packet.size = n;
+
+	// Find first surface hit by each ray, a ray only uses the hint of its own pixel so that the result does not depend on the tiles
+	HitRecord records[RayPacket::max_size];
+	m_bvh.hit(packet, records, hit_hints ? hints : nullptr);
+
+	for (int l = 0; l < n; ++l) {
+		PixelState& pixel = *pixels[l];
+		Sampler& sampler = pixel.sampler;
+		const int slot = pixel.first_slot + samples[l] - pixel.n_samples;
+
+		// The first two random numbers of the sample offset its ray
+		sampler.start_sample(samples[l]);
+		sampler.skip(2);
+
+		const HitRecord& record = records[l];
+		if (record.index < 0) {
+			// No surface hit, the sample stays black
+			continue;
+		}
 
-				// View direction
-				Vec3 dir_view = ray.dir * -1;
+		pixel.normal_sum += record.normal;
 
-				// Surface color at hit point (to compute)
-				Color c_sample(0);
+		if (record.t < pixel.depth) {
+			pixel.depth = record.t;
+			pixel.uid = static_cast<float>(record.surface->uid());
+		}
 
-				// Direct lighting
-				c_sample += direct_lighting(surface, scene, pos, normal, dir_view);
+		// View direction
+		Vec3 dir_view = Vec3(packet.dir_x[l], packet.dir_y[l], packet.dir_z[l]) * -1;
 
-				// Indirect lighting
-				c_sample += indirect_lighting(surface, scene, pos, normal, dir_view, max_bounce);
+		// Surface color at hit point (to compute)
+		Color c_sample(0);
+
+		// Direct lighting
+		c_sample += direct_lighting(record, dir_view, sampler);
+
+		// Indirect lighting
+		if (integrator == Integrator::PathTracing) {
+			c_sample += path_lighting(record, dir_view, sampler);
+		}
+		else {
+			c_sample += indirect_lighting(record, dir_view, max_bounce, sampler);
+		}
 
-				// Add sample contribution
-				c_out += c_sample / static_cast<float>(pixel_sampling);
+		colors[slot] = c_sample;
+	}
+}
+
+bool RayTracer::converged(const PixelState& pixel) const
+{
+	const int n = pixel.n_samples;
+	if (n < std::max(2, min_pixel_sampling)) {
+		return false;
+	}
+
+	// Half-width of the 95% confidence interval of the mean, relative to the mean so that bright pixels can converge too
+	const float variance = pixel.m2 / static_cast<float>(n - 1);
+	const float half_width = 1.96f * std::sqrt(variance / static_cast<float>(n));
+	return half_width / std::max(pixel.mean, eps_div_by_zero) <= noise_threshold;
+}
+
+void RayTracer::render(const Scene& scene, std::function<void(int)> progress_callback)
+{
+	reset();
+	render_pass(scene, pixel_sampling, progress_callback);
+}
+
+void RayTracer::reset()
+{
+	m_pixels.clear();
+}
+
+void RayTracer::render_pass(const Scene& scene, int n_samples, std::function<void(int)> progress_callback)
+{
+	// Start timer
+	spdlog::info("start rendering");
+	auto time_start = std::chrono::steady_clock::now();
+
+	// Dimensions
+	const int width = image.width();
+	const int height = image.height();
+	spdlog::info("dimensions: {}x{}", width, height);
+
+	// Samples taken with another seed or for other dimensions cannot be continued
+	if (seed != m_seed || width != m_width || height != m_height) {
+		reset();
+	}
+
+	// The first pass after a reset prepares the scene, later passes reuse it
+	if (m_pixels.empty()) {
+		// Precomputations
+		for (const auto& s : scene.surfaces()) {
+			s->prepare(n_threads);
+		}
+
+		// Type-sorted snapshot and acceleration structure
+		m_scene = scene.commit();
+		m_bvh.update(m_scene);
+
+		// Pixel states, the random numbers of a pixel are independent of the order in which pixels are rendered
+		m_seed = seed;
+		m_width = width;
+		m_height = height;
+		m_pixels.reserve(static_cast<std::size_t>(width) * height);
+		for (int i = 0; i < height; i++) {
+			for (int j = 0; j < width; j++) {
+				Sampler sampler(seed, static_cast<std::uint32_t>(i * width + j));
+				m_pixels.push_back(PixelState{ i, j, sampler, HitHint(), Color(0), Vec3(0), m_scene.camera->z_far, 0.f, 0, 0.f, 0.f, false, 0, 0, 0 });
 			}
+		}
+	}
+	spdlog::info("samples per pixel: {}", n_samples);
 
-			// Store results
-			image.set(i, j, c_out);
+	// Split work
+	const int n_workers = n_threads > 0 ? n_threads : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	TileScheduler scheduler(width, height, tile_size, n_workers);
+	spdlog::info("threads: {}, tiles: {}", n_workers, scheduler.n_tiles());
+	spdlog::info("kernels: {}", instruction_set_name(dispatched_instruction_set()));
 
-			n_out.normalize();
-			normal_map.set(i, j, n_out);
-			depth_map.set(i, j, depth_min);
-			index_map.set(i, j, uid_out);
+	// First progress callback
+	int progress = 0;
+	progress_callback(0);
 
-			// Every time progress reaches one percent more, call progress callback
-			progress++;
-			if((progress * 100) % (width * height) == 0) {
-				progress_callback((progress * 100) / (width * height));
+	// Number of rendered pixels and whether or not a worker has failed, shared by all threads
+	const long long n_pixels = static_cast<long long>(width) * height;
+	long long n_done = 0;
+	bool failed = false;
+	std::mutex mutex;
+	std::condition_variable cv;
+	auto percent_done = [&]() -> int {
+		return n_pixels > 0 ? static_cast<int>((n_done * 100) / n_pixels) : 100;
+	};
+
+	// Render tiles until none is left, the workers are stopped and joined even if the progress callback throws
+	WorkerGroup workers;
+	workers.start(n_workers, [&](int w) {
+		Tile tile;
+		try {
+			while (!workers.stopped() && scheduler.next(w, tile)) {
+				render_tile(tile, n_samples);
+				{
+					// Update under lock so that the calling thread cannot miss the notification
+					std::lock_guard<std::mutex> lock(mutex);
+					n_done += tile.area();
+				}
+				cv.notify_one();
+			}
+		}
+		catch (...) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				failed = true;
 			}
+			cv.notify_one();
+			throw;
+		}
+	});
+
+	// Every time progress reaches one percent more, call progress callback (from the calling thread only)
+	while (progress < 100) {
+		int new_progress = 0;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [&]() { return percent_done() > progress || failed; });
+			if (failed) {
+				break;
+			}
+			new_progress = percent_done();
+		}
+		while (progress < new_progress) {
+			progress++;
+			progress_callback(progress);
 		}
 	}
 
+	// Rethrow the exception of a failed worker
+	workers.join();
+
 	// Stop timer and compute elapsed time
 	auto time_end = std::chrono::steady_clock::now();
 	std::chrono::duration<double> elapsed_seconds = time_end - time_start;
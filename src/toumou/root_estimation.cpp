@@ -1,45 +1,536 @@
 #include <toumou/root_estimation.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 
 namespace toumou {
 
-bool RootEstimator::find_first_root(const Ray& ray,
-									std::function<float(const Vec3&)> field,
-									std::function<float(const Ray&, float)> ray_derivative,
-									float& t_root) const
+FieldLevel::FieldLevel(const Field& field, float level, const FieldProgram* program) :
+	m_field(field), m_level(level), m_program(program)
+{
+}
+
+float FieldLevel::value(const Vec3& pos) const
+{
+	return (m_program ? m_program->value(pos) : m_field.value(pos)) - m_level;
+}
+
+void FieldLevel::value_batch(const float* xs, const float* ys, const float* zs, float* out, std::size_t n) const
+{
+	if (m_program) {
+		m_program->value_batch(xs, ys, zs, out, n);
+	}
+	else {
+		m_field.value_batch(xs, ys, zs, out, n);
+	}
+	for (std::size_t i = 0; i < n; ++i) {
+		out[i] -= m_level;
+	}
+}
+
+Vec3 FieldLevel::gradient(const Vec3& pos) const
+{
+	return m_program ? m_program->value_and_gradient(pos).gradient : m_field.value_and_gradient(pos).gradient;
+}
+
+float FieldLevel::value_and_ray_derivative(const Ray& ray, float t, float& derivative) const
+{
+	if (m_program) {
+		const Dual out = m_program->value_and_gradient(ray.at(t));
+		derivative = out.gradient.dot(ray.dir);
+		return out.value - m_level;
+	}
+	return m_field.value_and_ray_derivative(ray, t, derivative) - m_level;
+}
+
+float FieldLevel::lipschitz(const Vec3& center, float radius) const
+{
+	return m_field.lipschitz(center, radius);
+}
+
+Interval FieldLevel::range(const Box3& box) const
+{
+	// Unbounded ends stay unbounded
+	const Interval range = m_field.range(box);
+	const float inf = std::numeric_limits<float>::max();
+	return Interval(range.min > -inf ? range.min - m_level : range.min, range.max < inf ? range.max - m_level : range.max);
+}
+
+RootStatistics& RootStatistics::operator+=(const RootStatistics& other)
+{
+	searches += other.searches;
+	roots += other.roots;
+	evaluations += other.evaluations;
+	range_evaluations += other.range_evaluations;
+	iterations += other.iterations;
+	failures += other.failures;
+	hint_misses += other.hint_misses;
+	return *this;
+}
+
+float RootEstimator::detail(const Ray& ray, float t) const
+{
+	if (footprint_scale <= 0.f) {
+		return 1.f;
+	}
+	return std::max(1.f, footprint_scale * ray.footprint(t) / sampling_step);
+}
+
+template<typename F>
+bool RootEstimator::find_first_root(const Ray& ray, const F& field, float& t_root, RootStatistics* statistics) const
+{
+	if (statistics) {
+		statistics->searches++;
+	}
+
+	// 1st step: Linear sampling, the root lies between the first positive sample and the previous one
+	float t_lo = t_min;
+	float t_hi = t_min;
+	float value_lo = 0.f;
+	float value_hi = 0.f;
+	if (!first_positive_sample(ray, field, t_max, std::numeric_limits<float>::infinity(), t_lo, value_lo, t_hi, value_hi, statistics) 
+		|| t_hi <= t_min) {
+		return false;
+	}
+
+	// 2nd step: Refinement inside the bracket
+	t_root = refine(ray, field, t_lo, value_lo, t_hi, value_hi, statistics);
+	return true;
+}
+
+template<typename F>
+bool RootEstimator::trace_first_root(const Ray& ray, const F& field, float& t_root, RootStatistics* statistics) const
 {
+	if (statistics) {
+		statistics->searches++;
+		statistics->evaluations++;
+	}
+
 	float t = t_min;
+	float value = field.value(ray.at(t));
 
-	// 1st step: Linear sampling
-	bool has_root = false;
-	while (t < t_max) {
-		Vec3 pos = ray.at(t);
-		if (field(pos) > 0) {
-			return false;
+	// Starting inside the surface
+	if (value > 0) {
+		return false;
+	}
+
+	// 1st step: Segment tracing
+	float segment = sampling_step;
+	for (int step = 0; step < max_steps && t < t_max; ++step) {
+
+		// Close enough to the surface
+		const float scale = detail(ray, t);
+		if (std::abs(value) <= threshold * scale) {
+			t_root = t;
+			if (statistics) {
+				statistics->roots++;
+			}
+			return true;
 		}
-		Vec3 next_pos = ray.at(t + sampling_step);
-		if (field(next_pos) > 0) {
-			has_root = true;
-			break;
+
+		// Bound the field's variation on the segment ahead
+		segment = std::min(segment, t_max - t);
+		const float half = .5f * segment;
+		const float lambda = field.lipschitz(ray.at(t + half), half);
+
+		// Largest step for which the field cannot reach zero, fixed step if no bound is known
+		float dt = segment;
+		if (!std::isfinite(lambda)) {
+			dt = std::min(segment, sampling_step * scale);
+		}
+		else if (lambda > 0.f) {
+			dt = std::min(segment, std::abs(value) / lambda);
+		}
+
+		// Only fixed steps can cross the surface, refine the root as usual
+		const float next_value = field.value(ray.at(t + dt));
+		if (statistics) {
+			statistics->evaluations++;
 		}
-		t += sampling_step;
+		if (next_value > 0) {
+			t_root = refine(ray, field, t, value, t + dt, next_value, statistics);
+			return true;
+		}
+
+		t += dt;
+		value = next_value;
+
+		// Try a longer segment next time
+		segment = 2.f * dt;
 	}
-	if (!has_root) {
+
+	return false;
+}
+
+template<typename F>
+bool RootEstimator::isolate_first_root(const Ray& ray, const F& field, float& t_root, RootStatistics* statistics) const
+{
+	// Without a bound on the field no segment can be discarded, sample the ray instead
+	const Interval range = field.range(segment_bounds(ray, t_min, t_max));
+	if (statistics) {
+		statistics->range_evaluations++;
+	}
+	if (!range.isEmpty() && !is_bounded(range)) {
+		return find_first_root(ray, field, t_root, statistics);
+	}
+
+	if (statistics) {
+		statistics->searches++;
+		statistics->evaluations++;
+	}
+
+	// Starting inside the surface
+	if (field.value(ray.at(t_min)) > 0) {
 		return false;
 	}
 
-	// 2nd step: Refinement with Newton's method
-	int iter = 0;
-	float value = field(ray.at(t));
-	while (std::abs(value) > 1e-3f && iter < max_iterations) {
-		float derivative = ray_derivative(ray, t);
-		t -= value / derivative;
-		value = field(ray.at(t));
-		iter++;
+	// 1st step: Bisection, segments are processed from front to back
+	constexpr int max_depth = 48;
+	struct Segment {
+		float t_start;
+		float t_end;
+		int depth;
+	};
+	Segment stack[max_depth + 1];
+	int size = 0;
+	stack[size++] = { t_min, t_max, 0 };
+	while (size > 0) {
+		const Segment segment = stack[--size];
+
+		// The field cannot reach zero on this segment (the whole ray's range is already known)
+		if (segment.depth > 0 && statistics) {
+			statistics->range_evaluations++;
+		}
+		const float range_max = segment.depth > 0 ? field.range(segment_bounds(ray, segment.t_start, segment.t_end)).max : range.max;
+		if (range_max < 0) {
+			continue;
+		}
+
+		// Short enough to refine the root as usual, or to neglect a root which does not change the field's sign
+		const float length = segment.t_end - segment.t_start;
+		const float scale = detail(ray, segment.t_start);
+		if (length <= sampling_step * scale) {
+			const float value_end = field.value(ray.at(segment.t_end));
+			if (statistics) {
+				statistics->evaluations++;
+			}
+			if (value_end > 0) {
+				const float value_start = field.value(ray.at(segment.t_start));
+				if (statistics) {
+					statistics->evaluations++;
+				}
+				t_root = refine(ray, field, segment.t_start, value_start, segment.t_end, value_end, statistics);
+				return true;
+			}
+		}
+		if (length <= threshold * scale || segment.depth >= max_depth) {
+			continue;
+		}
+
+		const float t_mid = segment.t_start + .5f * length;
+		stack[size++] = { t_mid, segment.t_end, segment.depth + 1 };
+		stack[size++] = { segment.t_start, t_mid, segment.depth + 1 };
+	}
+
+	return false;
+}
+
+template<typename F>
+bool RootEstimator::first_root(const Ray& ray, const F& field, float& t_root, RootStatistics* statistics) const
+{
+	switch (search) {
+	case RootSearch::SphereTracing:
+		return trace_first_root(ray, field, t_root, statistics);
+	case RootSearch::Isolation:
+		return isolate_first_root(ray, field, t_root, statistics);
+	default:
+		return find_first_root(ray, field, t_root, statistics);
+	}
+}
+
+template<typename F>
+bool RootEstimator::first_root_near(const Ray& ray, const F& field, float t_hint, float& t_root, RootStatistics* statistics) const
+{
+	if (!(t_hint > t_min && t_hint < t_max)) {
+		return first_root(ray, field, t_root, statistics);
+	}
+
+	auto fall_back = [&]() {
+		if (statistics) {
+			statistics->hint_misses++;
+		}
+		return first_root(ray, field, t_root, statistics);
+	};
+
+	// 1st step: Bracket around the hint, moved and widened until the field changes sign
+	constexpr int max_expansions = 4;
+	float width = sampling_step * detail(ray, t_hint);
+	float t_lo = std::max(t_min, t_hint - width);
+	float t_hi = std::min(t_max, t_hint + width);
+	float value_lo = field.value(ray.at(t_lo));
+	float value_hi = field.value(ray.at(t_hi));
+	if (statistics) {
+		statistics->evaluations += 2;
+	}
+	for (int expansion = 0; value_lo > 0 || value_hi <= 0; ++expansion) {
+		if (expansion >= max_expansions) {
+			return fall_back();
+		}
+		width *= 2.f;
+		if (value_lo > 0) {
+			// Inside the surface before the bracket, the root is closer
+			if (t_lo <= t_min) {
+				return fall_back();
+			}
+			t_hi = t_lo;
+			value_hi = value_lo;
+			t_lo = std::max(t_min, t_lo - width);
+			value_lo = field.value(ray.at(t_lo));
+		}
+		else {
+			// Outside the surface after the bracket, the root is farther
+			if (t_hi >= t_max) {
+				return fall_back();
+			}
+			t_lo = t_hi;
+			value_lo = value_hi;
+			t_hi = std::min(t_max, t_hi + width);
+			value_hi = field.value(ray.at(t_hi));
+		}
+		if (statistics) {
+			statistics->evaluations++;
+		}
+	}
+
+	// 2nd step: The root inside the bracket is the first one only if the field cannot reach zero before it
+	if (!excludes_root(ray, field, t_min, t_lo, statistics)) {
+		return fall_back();
+	}
+	if (statistics) {
+		statistics->searches++;
+	}
+
+	// 3rd step: Linear sampling of the bracket, which may contain several roots
+	RootEstimator bracket = *this;
+	bracket.t_min = t_lo;
+	float t_before = t_lo;
+	float t_after = t_hi;
+	float value_before = value_lo;
+	float value_after = value_hi;
+	if (bracket.first_positive_sample(ray, field, t_hi, t_hi, t_before, value_before, t_after, value_after, statistics) && t_after > t_lo) {
+		t_lo = t_before;
+		t_hi = t_after;
+		value_lo = value_before;
+		value_hi = value_after;
 	}
 
-	t_root = t;
+	// 4th step: Refinement inside the bracket
+	t_root = refine(ray, field, t_lo, value_lo, t_hi, value_hi, statistics);
 	return true;
 }
 
+template<typename F>
+bool RootEstimator::leave_root(const Ray& ray, const F& field, RootStatistics* statistics)
+{
+	while (t_min < t_max) {
+		const float scale = detail(ray, t_min);
+		const float value = field.value(ray.at(t_min));
+		if (statistics) {
+			statistics->evaluations++;
+		}
+		if (std::abs(value) > threshold * scale) {
+			return true;
+		}
+		t_min += sampling_step * scale;
+	}
+	return false;
+}
+
+template<typename F>
+bool RootEstimator::excludes_root(const Ray& ray, const F& field, float t_start, float t_end, RootStatistics* statistics) const
+{
+	// Bisection, giving up on the segments that are still undecided after the budget is spent
+	constexpr int max_segments = 64;
+	struct Segment {
+		float t_start;
+		float t_end;
+	};
+	Segment stack[max_segments + 1];
+	int size = 0;
+	if (t_end > t_start) {
+		stack[size++] = { t_start, t_end };
+	}
+	for (int n = 0; size > 0; ++n) {
+		if (n >= max_segments) {
+			return false;
+		}
+		const Segment segment = stack[--size];
+		const Interval range = field.range(segment_bounds(ray, segment.t_start, segment.t_end));
+		if (statistics) {
+			statistics->range_evaluations++;
+		}
+		if (range.max < 0) {
+			continue;
+		}
+
+		// No bound known, or a possible root
+		if (!is_bounded(range) || segment.t_end - segment.t_start <= threshold * detail(ray, segment.t_start)) {
+			return false;
+		}
+
+		const float t_mid = segment.t_start + .5f * (segment.t_end - segment.t_start);
+		stack[size++] = { t_mid, segment.t_end };
+		stack[size++] = { segment.t_start, t_mid };
+	}
+	return true;
+}
+
+template<typename F>
+float RootEstimator::refine(const Ray& ray, const F& field, float t_lo, float value_lo, float t_hi, float value_hi, 
+							RootStatistics* statistics) const
+{
+	if (statistics) {
+		statistics->roots++;
+	}
+
+	// The bracket's lower end is already on the surface (or inside it if the 1st pass overestimated it)
+	const float tolerance = threshold * detail(ray, t_lo);
+	if (value_lo >= -tolerance) {
+		return t_lo;
+	}
+
+	// Start from the secant of the bracket
+	float t = (t_lo * value_hi - t_hi * value_lo) / (value_hi - value_lo);
+	int side = 0;
+	for (int iter = 0; iter < max_iterations; ++iter) {
+		float derivative = 0.f;
+		const float value = field.value_and_ray_derivative(ray, t, derivative);
+		if (statistics) {
+			statistics->evaluations++;
+			statistics->iterations++;
+		}
+		if (std::abs(value) <= tolerance) {
+			return t;
+		}
+
+		// Shrink the bracket, the value of an end kept twice in a row is halved (Illinois)
+		if (value > 0) {
+			t_hi = t;
+			value_hi = value;
+			value_lo *= side > 0 ? .5f : 1.f;
+			side = 1;
+		}
+		else {
+			t_lo = t;
+			value_lo = value;
+			value_hi *= side < 0 ? .5f : 1.f;
+			side = -1;
+		}
+		if (t_hi - t_lo <= std::numeric_limits<float>::epsilon() * std::max(1.f, t_hi)) {
+			return t;
+		}
+
+		// Newton step if it stays inside the bracket (this also rejects null derivatives), regula falsi otherwise
+		const float t_newton = t - value / derivative;
+		if (t_newton > t_lo && t_newton < t_hi) {
+			t = t_newton;
+		}
+		else {
+			t = (t_lo * value_hi - t_hi * value_lo) / (value_hi - value_lo);
+		}
+	}
+
+	if (statistics) {
+		statistics->failures++;
+	}
+	return t;
+}
+
+template<typename F>
+bool RootEstimator::has_root(const Ray& ray, const F& field, float t_limit, RootStatistics* statistics) const
+{
+	if (statistics) {
+		statistics->searches++;
+	}
+
+	// Linear sampling up to the first sign change, a positive first sample means starting inside the surface
+	float t_before = t_min;
+	float t_after = t_min;
+	float value_before = 0.f;
+	float value_after = 0.f;
+	const bool found = first_positive_sample(ray, field, std::min(t_max, t_limit), t_limit, t_before, value_before, t_after, value_after, statistics) 
+		&& t_after > t_min;
+	if (found && statistics) {
+		statistics->roots++;
+	}
+	return found;
+}
+
+template<typename F>
+bool RootEstimator::first_positive_sample(const Ray& ray, const F& field, float t_end, float t_clamp, float& t_before, float& value_before, 
+										  float& t_after, float& value_after, RootStatistics* statistics) const
+{
+	constexpr int batch_size = 8;
+	float ts[batch_size], xs[batch_size], ys[batch_size], zs[batch_size], values[batch_size];
+
+	// Samples are taken at t_min + steps * sampling_step, steps grows by one unless the ray's footprint is larger
+	float steps = 0.f;
+	float t_previous = t_min;
+	for (bool first = true; ; first = false) {
+
+		// Samples of the batch, stopping after the end of the search range
+		int n = 0;
+		for (; n < batch_size; ++n) {
+			if (!(first && n == 0) && t_previous >= t_end) {
+				break;
+			}
+			const float t = t_min + steps * sampling_step;
+			ts[n] = std::min(t, t_clamp);
+			Vec3 pos = ray.at(ts[n]);
+			xs[n] = pos.x;
+			ys[n] = pos.y;
+			zs[n] = pos.z;
+			t_previous = t;
+			steps += detail(ray, t);
+		}
+		if (n == 0) {
+			return false;
+		}
+
+		field.value_batch(xs, ys, zs, values, static_cast<std::size_t>(n));
+		if (statistics) {
+			statistics->evaluations += static_cast<std::uint64_t>(n);
+		}
+		for (int i = 0; i < n; ++i) {
+			if (values[i] > 0) {
+				t_after = ts[i];
+				value_after = values[i];
+				return true;
+			}
+			t_before = ts[i];
+			value_before = values[i];
+		}
+		if (n < batch_size) {
+			return false;
+		}
+	}
+}
+
+template bool RootEstimator::find_first_root<Field>(const Ray&, const Field&, float&, RootStatistics*) const;
+template bool RootEstimator::find_first_root<FieldLevel>(const Ray&, const FieldLevel&, float&, RootStatistics*) const;
+template bool RootEstimator::trace_first_root<Field>(const Ray&, const Field&, float&, RootStatistics*) const;
+template bool RootEstimator::trace_first_root<FieldLevel>(const Ray&, const FieldLevel&, float&, RootStatistics*) const;
+template bool RootEstimator::isolate_first_root<Field>(const Ray&, const Field&, float&, RootStatistics*) const;
+template bool RootEstimator::isolate_first_root<FieldLevel>(const Ray&, const FieldLevel&, float&, RootStatistics*) const;
+template bool RootEstimator::first_root<Field>(const Ray&, const Field&, float&, RootStatistics*) const;
+template bool RootEstimator::first_root<FieldLevel>(const Ray&, const FieldLevel&, float&, RootStatistics*) const;
+template bool RootEstimator::first_root_near<Field>(const Ray&, const Field&, float, float&, RootStatistics*) const;
+template bool RootEstimator::first_root_near<FieldLevel>(const Ray&, const FieldLevel&, float, float&, RootStatistics*) const;
+template bool RootEstimator::has_root<Field>(const Ray&, const Field&, float, RootStatistics*) const;
+template bool RootEstimator::has_root<FieldLevel>(const Ray&, const FieldLevel&, float, RootStatistics*) const;
+template bool RootEstimator::leave_root<Field>(const Ray&, const Field&, RootStatistics*);
+template bool RootEstimator::leave_root<FieldLevel>(const Ray&, const FieldLevel&, RootStatistics*);
+
 }
@@ -0,0 +1,78 @@
+#include <toumou/sampling.hpp>
+
+
+namespace toumou {
+
+namespace {
+
+/// PCG hash of a single integer (Jarzynski & Olano, "Hash Functions for GPU Rendering").
+std::uint32_t pcg(std::uint32_t v)
+{
+	std::uint32_t state = v * 747796405u + 2891336453u;
+	std::uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+/// PCG hash of four integers, every output bit depends on every input bit.
+std::uint32_t pcg4d(std::uint32_t x, std::uint32_t y, std::uint32_t z, std::uint32_t w)
+{
+	x = x * 1664525u + 1013904223u;
+	y = y * 1664525u + 1013904223u;
+	z = z * 1664525u + 1013904223u;
+	w = w * 1664525u + 1013904223u;
+
+	x += y * w; y += z * x; z += x * y; w += y * z;
+
+	x ^= x >> 16u;
+	y ^= y >> 16u;
+	z ^= z >> 16u;
+	w ^= w >> 16u;
+
+	x += y * w; y += z * x; z += x * y; w += y * z;
+
+	return x;
+}
+
+/// Map the 24 most significant bits of an integer to [0, 1).
+float to_unit_float(std::uint32_t v)
+{
+	return static_cast<float>(v >> 8u) * (1.f / 16777216.f);
+}
+
+}
+
+Sampler::Sampler(std::uint32_t seed, std::uint32_t pixel) :
+	m_seed(pcg(seed)), m_pixel(pixel),
+	m_sample(0), m_bounce(0), m_dimension(0)
+{
+}
+
+void Sampler::start_sample(std::uint32_t index)
+{
+	m_sample = index;
+	m_bounce = 0;
+	m_dimension = 0;
+}
+
+void Sampler::start_bounce(std::uint32_t bounce)
+{
+	m_bounce = bounce;
+	m_dimension = 0;
+}
+
+float Sampler::next()
+{
+	return get(m_sample, m_bounce, m_dimension++);
+}
+
+void Sampler::skip(std::uint32_t count)
+{
+	m_dimension += count;
+}
+
+float Sampler::get(std::uint32_t sample, std::uint32_t bounce, std::uint32_t dimension) const
+{
+	return to_unit_float(pcg4d(m_pixel, sample, bounce, dimension ^ m_seed));
+}
+
+}
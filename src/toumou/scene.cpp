@@ -1,5 +1,7 @@
 #include <toumou/scene.hpp>
 
+#include <typeinfo>
+
 
 namespace toumou {
 
@@ -23,7 +25,7 @@ void Scene::set_env_light(std::shared_ptr<EnvironmentLight> light)
 	m_env_light = light;
 }
 
-std::shared_ptr<Camera> Scene::camera() const
+const std::shared_ptr<Camera>& Scene::camera() const
 {
 	return m_camera;
 }
@@ -38,9 +40,92 @@ const std::vector<std::shared_ptr<Surface>>& Scene::surfaces() const
 	return m_surfaces;
 }
 
-std::shared_ptr<EnvironmentLight> Scene::env_light() const
+const std::shared_ptr<EnvironmentLight>& Scene::env_light() const
 {
 	return m_env_light;
 }
 
+CommittedScene Scene::commit() const
+{
+	CommittedScene committed;
+	committed.camera = m_camera;
+	committed.env_light = m_env_light;
+
+	// Surfaces, sorted by exact type so that derived types keep their own behavior
+	committed.surfaces = m_surfaces;
+	for (int index = 0; index < static_cast<int>(m_surfaces.size()); ++index) {
+		const Surface& surface = *m_surfaces[index];
+		const std::type_info& type = typeid(surface);
+		if (type == typeid(Sphere)) {
+			committed.types.push_back(SurfaceType::Sphere);
+			committed.type_indices.push_back(committed.spheres.size());
+			committed.spheres.add(static_cast<const Sphere&>(surface), index);
+		}
+		else if (type == typeid(Plane)) {
+			committed.types.push_back(SurfaceType::Plane);
+			committed.type_indices.push_back(committed.planes.size());
+			committed.planes.add(static_cast<const Plane&>(surface), index);
+		}
+		else if (type == typeid(Tube)) {
+			committed.types.push_back(SurfaceType::Tube);
+			committed.type_indices.push_back(committed.tubes.size());
+			committed.tubes.add(static_cast<const Tube&>(surface), index);
+		}
+		else if (type == typeid(ImplicitSurface)) {
+			committed.types.push_back(SurfaceType::Implicit);
+			committed.type_indices.push_back(static_cast<int>(committed.implicit_surfaces.size()));
+			committed.implicit_surfaces.push_back(static_cast<const ImplicitSurface*>(&surface));
+			committed.implicit_indices.push_back(index);
+		}
+		else {
+			committed.types.push_back(SurfaceType::Other);
+			committed.type_indices.push_back(static_cast<int>(committed.other_surfaces.size()));
+			committed.other_surfaces.push_back(index);
+		}
+		committed.materials.push_back(surface.material);
+	}
+
+	// Lights, sorted the same way
+	committed.lights = m_lights;
+	for (const auto& light : m_lights) {
+		const std::type_info& type = typeid(*light);
+		if (type == typeid(PointLight)) {
+			committed.point_lights.add(static_cast<const PointLight&>(*light));
+		}
+		else if (type == typeid(DirectionalLight)) {
+			committed.directional_lights.add(static_cast<const DirectionalLight&>(*light));
+		}
+		else {
+			committed.other_lights.push_back(light.get());
+		}
+	}
+
+	return committed;
+}
+
+int CommittedScene::n_lights() const
+{
+	return point_lights.size() + directional_lights.size() + static_cast<int>(other_lights.size());
+}
+
+void CommittedScene::sample_light(int k, const Vec3& pos, Vec3& dir, float& dist, float& intensity, Color& color) const
+{
+	if (k < point_lights.size()) {
+		point_lights.sample(k, pos, dir, dist, intensity);
+		color = point_lights.color[k];
+		return;
+	}
+	k -= point_lights.size();
+
+	if (k < directional_lights.size()) {
+		directional_lights.sample(k, pos, dir, dist, intensity);
+		color = directional_lights.color[k];
+		return;
+	}
+	k -= directional_lights.size();
+
+	other_lights[k]->sample(pos, dir, dist, intensity);
+	color = other_lights[k]->color;
+}
+
 }
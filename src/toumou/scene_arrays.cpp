@@ -0,0 +1,204 @@
+#include <toumou/scene_arrays.hpp>
+#include <toumou/dispatch.hpp>
+
+
+namespace toumou {
+
+void SphereArrays::add(const Sphere& sphere, int index)
+{
+	center_x.push_back(sphere.center.x);
+	center_y.push_back(sphere.center.y);
+	center_z.push_back(sphere.center.z);
+	radius.push_back(sphere.radius);
+	surface.push_back(index);
+}
+
+int SphereArrays::size() const
+{
+	return static_cast<int>(surface.size());
+}
+
+bool SphereArrays::hit(int k, const Ray& ray, float& t) const
+{
+	return intersect_sphere(ray.origin, ray.dir, Vec3(center_x[k], center_y[k], center_z[k]), radius[k], t);
+}
+
+TOUMOU_DISPATCH
+void SphereArrays::hit(int k, const RayPacket& packet, float* t_closest, int* closest) const
+{
+	const Vec3 center(center_x[k], center_y[k], center_z[k]);
+	const float r = radius[k];
+	const int index = surface[k];
+
+	// Same computation as for a single ray, the test has no branch so that the loop is vectorized
+	for (int i = 0; i < RayPacket::max_size; ++i) {
+		float t = 0.f;
+		const bool found = intersect_sphere(Vec3(packet.origin_x[i], packet.origin_y[i], packet.origin_z[i]), 
+			Vec3(packet.dir_x[i], packet.dir_y[i], packet.dir_z[i]), center, r, t);
+		const bool hit = found && t < t_closest[i];
+		t_closest[i] = hit ? t : t_closest[i];
+		closest[i] = hit ? index : closest[i];
+	}
+}
+
+bool SphereArrays::occluded(int k, const Ray& ray, float t_max) const
+{
+	float t = 0.f;
+	return hit(k, ray, t) && t < t_max;
+}
+
+Vec3 SphereArrays::normal(int k, const Vec3& pos) const
+{
+	return (pos - Vec3(center_x[k], center_y[k], center_z[k])).normalized();
+}
+
+Box3 SphereArrays::bounds(int k) const
+{
+	const Vec3 center(center_x[k], center_y[k], center_z[k]);
+	return Box3(center - Vec3(radius[k]), center + Vec3(radius[k]));
+}
+
+void PlaneArrays::add(const Plane& plane, int index)
+{
+	origin_x.push_back(plane.origin.x);
+	origin_y.push_back(plane.origin.y);
+	origin_z.push_back(plane.origin.z);
+	normal_x.push_back(plane.normal.x);
+	normal_y.push_back(plane.normal.y);
+	normal_z.push_back(plane.normal.z);
+	surface.push_back(index);
+}
+
+int PlaneArrays::size() const
+{
+	return static_cast<int>(surface.size());
+}
+
+bool PlaneArrays::hit(int k, const Ray& ray, float& t) const
+{
+	return intersect_plane(ray.origin, ray.dir, Vec3(origin_x[k], origin_y[k], origin_z[k]), normal(k), t);
+}
+
+TOUMOU_DISPATCH
+void PlaneArrays::hit(int k, const RayPacket& packet, float* t_closest, int* closest) const
+{
+	const Vec3 origin(origin_x[k], origin_y[k], origin_z[k]);
+	const Vec3 n = normal(k);
+	const int index = surface[k];
+
+	for (int i = 0; i < RayPacket::max_size; ++i) {
+		float t = 0.f;
+		const bool found = intersect_plane(Vec3(packet.origin_x[i], packet.origin_y[i], packet.origin_z[i]), 
+			Vec3(packet.dir_x[i], packet.dir_y[i], packet.dir_z[i]), origin, n, t);
+		const bool hit = found && t < t_closest[i];
+		t_closest[i] = hit ? t : t_closest[i];
+		closest[i] = hit ? index : closest[i];
+	}
+}
+
+bool PlaneArrays::occluded(int k, const Ray& ray, float t_max) const
+{
+	float t = 0.f;
+	return hit(k, ray, t) && t < t_max;
+}
+
+Vec3 PlaneArrays::normal(int k) const
+{
+	return Vec3(normal_x[k], normal_y[k], normal_z[k]);
+}
+
+void TubeArrays::add(const Tube& tube, int index)
+{
+	origin_x.push_back(tube.origin.x);
+	origin_y.push_back(tube.origin.y);
+	origin_z.push_back(tube.origin.z);
+	direction_x.push_back(tube.direction.x);
+	direction_y.push_back(tube.direction.y);
+	direction_z.push_back(tube.direction.z);
+	radius.push_back(tube.radius);
+	surface.push_back(index);
+}
+
+int TubeArrays::size() const
+{
+	return static_cast<int>(surface.size());
+}
+
+bool TubeArrays::hit(int k, const Ray& ray, float& t) const
+{
+	const Vec3 origin(origin_x[k], origin_y[k], origin_z[k]);
+	const Vec3 direction(direction_x[k], direction_y[k], direction_z[k]);
+	return intersect_tube(ray.origin, ray.dir, origin, direction, radius[k], t);
+}
+
+TOUMOU_DISPATCH
+void TubeArrays::hit(int k, const RayPacket& packet, float* t_closest, int* closest) const
+{
+	const Vec3 origin(origin_x[k], origin_y[k], origin_z[k]);
+	const Vec3 direction(direction_x[k], direction_y[k], direction_z[k]);
+	const float r = radius[k];
+	const int index = surface[k];
+
+	for (int i = 0; i < RayPacket::max_size; ++i) {
+		float t = 0.f;
+		const bool found = intersect_tube(Vec3(packet.origin_x[i], packet.origin_y[i], packet.origin_z[i]), 
+			Vec3(packet.dir_x[i], packet.dir_y[i], packet.dir_z[i]), origin, direction, r, t);
+		const bool hit = found && t < t_closest[i];
+		t_closest[i] = hit ? t : t_closest[i];
+		closest[i] = hit ? index : closest[i];
+	}
+}
+
+bool TubeArrays::occluded(int k, const Ray& ray, float t_max) const
+{
+	float t = 0.f;
+	return hit(k, ray, t) && t < t_max;
+}
+
+Vec3 TubeArrays::normal(int k, const Vec3& pos) const
+{
+	const Vec3 origin(origin_x[k], origin_y[k], origin_z[k]);
+	const Vec3 direction(direction_x[k], direction_y[k], direction_z[k]);
+	const Vec3 q = origin + direction * direction.dot(pos - origin);
+	return (pos - q).normalized();
+}
+
+void PointLightArrays::add(const PointLight& light)
+{
+	location_x.push_back(light.location.x);
+	location_y.push_back(light.location.y);
+	location_z.push_back(light.location.z);
+	color.push_back(light.color);
+	brightness.push_back(light.brightness);
+}
+
+int PointLightArrays::size() const
+{
+	return static_cast<int>(brightness.size());
+}
+
+void PointLightArrays::sample(int k, const Vec3& pos, Vec3& dir, float& dist, float& intensity) const
+{
+	sample_point_light(Vec3(location_x[k], location_y[k], location_z[k]), brightness[k], pos, dir, dist, intensity);
+}
+
+void DirectionalLightArrays::add(const DirectionalLight& light)
+{
+	direction_x.push_back(light.direction.x);
+	direction_y.push_back(light.direction.y);
+	direction_z.push_back(light.direction.z);
+	color.push_back(light.color);
+	brightness.push_back(light.brightness);
+}
+
+int DirectionalLightArrays::size() const
+{
+	return static_cast<int>(brightness.size());
+}
+
+void DirectionalLightArrays::sample(int k, const Vec3& pos, Vec3& dir, float& dist, float& intensity) const
+{
+	sample_directional_light(Vec3(direction_x[k], direction_y[k], direction_z[k]), brightness[k], pos, dir, dist, intensity);
+}
+
+}
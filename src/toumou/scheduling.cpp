@@ -0,0 +1,138 @@
+#include <toumou/scheduling.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+
+namespace toumou {
+
+int Tile::area() const
+{
+	return (i_max - i_min) * (j_max - j_min);
+}
+
+TileScheduler::TileScheduler(int width, int height, int tile_size, int n_workers) :
+	m_n_tiles(0)
+{
+	tile_size = std::max(1, tile_size);
+	n_workers = std::max(1, n_workers);
+
+	// Split image into tiles, row by row
+	std::vector<Tile> tiles;
+	for (int i = 0; i < height; i += tile_size) {
+		for (int j = 0; j < width; j += tile_size) {
+			tiles.push_back({ i, std::min(i + tile_size, height), j, std::min(j + tile_size, width) });
+		}
+	}
+	m_n_tiles = static_cast<int>(tiles.size());
+
+	// Deal contiguous chunks of tiles to the workers for better locality
+	for (int w = 0; w < n_workers; ++w) {
+		auto queue = std::make_unique<Queue>();
+		const int begin = (w * m_n_tiles) / n_workers;
+		const int end = ((w + 1) * m_n_tiles) / n_workers;
+		queue->tiles.assign(tiles.begin() + begin, tiles.begin() + end);
+		m_queues.push_back(std::move(queue));
+	}
+}
+
+bool TileScheduler::next(int worker, Tile& tile)
+{
+	const int n_workers = static_cast<int>(m_queues.size());
+
+	// Own queue first
+	{
+		Queue& queue = *m_queues[worker];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tiles.empty()) {
+			tile = queue.tiles.front();
+			queue.tiles.pop_front();
+			return true;
+		}
+	}
+
+	// Steal from the other workers, starting with the next one
+	for (int k = 1; k < n_workers; ++k) {
+		Queue& victim = *m_queues[(worker + k) % n_workers];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tiles.empty()) {
+			tile = victim.tiles.back();
+			victim.tiles.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int TileScheduler::n_tiles() const
+{
+	return m_n_tiles;
+}
+
+WorkerGroup::~WorkerGroup()
+{
+	stop();
+	for (auto& thread : m_threads) {
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+}
+
+void WorkerGroup::start(int n_workers, std::function<void(int)> task)
+{
+	m_task = std::move(task);
+	for (int w = 0; w < n_workers; ++w) {
+		m_threads.emplace_back([this, w]() {
+			try {
+				m_task(w);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (!m_error) {
+					m_error = std::current_exception();
+				}
+				m_stopped = true;
+			}
+		});
+	}
+}
+
+bool WorkerGroup::stopped() const
+{
+	return m_stopped;
+}
+
+void WorkerGroup::stop()
+{
+	m_stopped = true;
+}
+
+void WorkerGroup::join()
+{
+	for (auto& thread : m_threads) {
+		thread.join();
+	}
+	m_threads.clear();
+
+	if (m_error) {
+		std::rethrow_exception(m_error);
+	}
+}
+
+void parallel_for(int n, int n_threads, const std::function<void(int)>& function)
+{
+	const int n_workers = n_threads > 0 ? n_threads : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	std::atomic<int> next(0);
+	WorkerGroup workers;
+	workers.start(n_workers, [&](int) {
+		for (int i = next++; i < n && !workers.stopped(); i = next++) {
+			function(i);
+		}
+	});
+	workers.join();
+}
+
+}
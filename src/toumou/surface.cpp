@@ -20,60 +20,232 @@ unsigned int Surface::uid() const
 	return m_uid;
 }
 
+bool Surface::hit_near(const Ray& ray, float t_hint, float& t, Vec3& n) const
+{
+	return hit(ray, t, n);
+}
+
+bool Surface::occluded(const Ray& ray, float t_max) const
+{
+	float t = 0.f;
+	Vec3 n;
+	return hit(ray, t, n) && t >= eps_ray_sep && t < t_max;
+}
+
+Box3 Surface::bounds() const
+{
+	return infinite_box();
+}
+
+void Surface::prepare(int n_threads)
+{
+	material.compile();
+}
+
 ImplicitSurface::ImplicitSurface(std::shared_ptr<Field> _field) :
 	Surface(),
-	field(_field)
+	field(_field), bounding_box(infinite_box())
 {
 }
 
+template<typename Search>
+bool ImplicitSurface::search_intervals(const Ray& ray, const FieldLevel& level, Search search, float t_max) const
+{
+	RootEstimator estimator = root_estimator;
+	estimator.t_max = std::min(estimator.t_max, t_max);
+	if (!m_occupancy.built_from(field.get())) {
+		// Search range clipped to the bounding box
+		const Box3 box = bounds();
+		if (is_bounded(box) || box.isEmpty()) {
+			const Vec3 inv_dir(1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z);
+			float t_enter = 0.f;
+			float t_exit = 0.f;
+			if (!intersect(box, ray, inv_dir, t_enter, t_exit)) {
+				return false;
+			}
+			estimator.t_min = std::max(estimator.t_min, t_enter);
+			estimator.t_max = std::min(estimator.t_max, t_exit);
+			if (estimator.t_min > estimator.t_max) {
+				return false;
+			}
+		}
+		return search(estimator);
+	}
+
+	float t_start = root_estimator.t_min;
+	float t_enter = 0.f;
+	float t_exit = 0.f;
+	while (m_occupancy.next_interval(ray, t_start, std::min(root_estimator.t_max, t_max), t_enter, t_exit)) {
+		if (t_enter <= root_estimator.t_min) {
+			// Starting inside the surface
+			if (level.value(ray.at(t_enter)) > 0.f) {
+				return false;
+			}
+			estimator.t_min = t_enter;
+		}
+		else {
+			// Start one step early, in an empty cell, so that a surface right at the entry is not taken for the inside
+			estimator.t_min = std::max(t_start, t_enter - root_estimator.sampling_step);
+		}
+		estimator.t_max = t_exit;
+		if (search(estimator)) {
+			return true;
+		}
+		t_start = t_exit;
+	}
+	return false;
+}
+
+template<typename Search>
+bool ImplicitSurface::search_occupied(const Ray& ray, const FieldLevel& level, Search search, float t_max) const
+{
+	RootStatistics statistics;
+	const bool found = search_intervals(ray, level, [&](const RootEstimator& estimator) {
+		return search(estimator, collect_statistics ? &statistics : nullptr);
+	}, t_max);
+	if (collect_statistics) {
+		std::lock_guard<std::mutex> lock(m_statistics_mutex);
+		m_statistics += statistics;
+	}
+	return found;
+}
+
 bool ImplicitSurface::hit(const Ray& ray, float& t, Vec3& n) const
 {
-	bool found_root = root_estimator.find_first_root(ray,
-		[this](const Vec3& pos) -> float {
-			return field->value(pos) - 1.f;
-		},
-		[this](const Ray& ray, float t) -> float {
-			return field->ray_derivative(ray, t);
-		},
-		t);
+	const FieldLevel level = level_field();
 
+	const bool found_root = search_occupied(ray, level, [&](const RootEstimator& estimator, RootStatistics* statistics) {
+		return estimator.first_root(ray, level, t, statistics);
+	});
 	if (!found_root) {
 		return false;
 	}
 
-	n = field->gradient(ray.at(t)) * -1;
-	n.normalize();
+	n = normal_at(ray, level, t);
+	return true;
+}
+
+bool ImplicitSurface::hit_near(const Ray& ray, float t_hint, float& t, Vec3& n) const
+{
+	const FieldLevel level = level_field();
 
+	// Only the range of occupied cells containing the hint starts near it
+	const bool found_root = search_occupied(ray, level, [&](const RootEstimator& estimator, RootStatistics* statistics) {
+		return estimator.first_root_near(ray, level, t_hint, t, statistics);
+	});
+	if (!found_root) {
+		return false;
+	}
+
+	n = normal_at(ray, level, t);
 	return true;
 }
 
-Sphere::Sphere(const Vec3& _center, float _radius) :
-	center(_center), radius(_radius)
+bool ImplicitSurface::occluded(const Ray& ray, float t_max) const
+{
+	const FieldLevel level = level_field();
+
+	// Search up to the light only, without computing the normal at the root
+	if (root_estimator.search == RootSearch::SphereTracing || root_estimator.search == RootSearch::Isolation) {
+		return search_occupied(ray, level, [&](const RootEstimator& estimator, RootStatistics* statistics) {
+			// Light rays start on the surface, whose root at their origin must not block them
+			RootEstimator shadow = estimator;
+			shadow.t_min = std::max(shadow.t_min, eps_ray_sep);
+			if (!shadow.leave_root(ray, level, statistics)) {
+				return false;
+			}
+			float t = 0.f;
+			return shadow.first_root(ray, level, t, statistics) && t >= eps_ray_sep && t < t_max;
+		}, t_max);
+	}
+
+	return search_occupied(ray, level, [&](const RootEstimator& estimator, RootStatistics* statistics) {
+		return estimator.t_min < t_max && estimator.has_root(ray, level, t_max, statistics);
+	}, t_max);
+}
+
+RootStatistics ImplicitSurface::statistics() const
 {
+	std::lock_guard<std::mutex> lock(m_statistics_mutex);
+	return m_statistics;
 }
 
-bool Sphere::hit(const Ray& ray, float& t, Vec3& n) const
+void ImplicitSurface::reset_statistics()
 {
-	float b = 2 * ray.dir.dot(ray.origin - center);
-	float c = (ray.origin - center).length2() - radius*radius;
+	std::lock_guard<std::mutex> lock(m_statistics_mutex);
+	m_statistics = RootStatistics();
+}
 
-	float delta = b*b - 4*c;
-	if (delta < 0) {
-		return false;
+Box3 ImplicitSurface::bounds() const
+{
+	if (m_program.compiled_from(field.get())) {
+		return m_bounds;
 	}
+	return unrefined_bounds();
+}
 
-	float t1 = (-b - std::sqrt(delta)) * .5f;
-	float t2 = (-b + std::sqrt(delta)) * .5f;
-	if (t1 < eps_ray_sep && t2 < eps_ray_sep) {
-		return false;
+void ImplicitSurface::prepare(int n_threads)
+{
+	Surface::prepare(n_threads);
+	m_program = compile(field);
+
+	m_bounds = unrefined_bounds();
+	if (bounds_depth > 0 && is_bounded(m_bounds)) {
+		m_bounds = field->refine_superlevel_bounds(1.f, m_bounds, bounds_depth);
+	}
+
+	const Box3 box = bounds();
+	if (occupancy_resolution > 0 && is_bounded(box) && !box.isEmpty()) {
+		m_occupancy.build(field, 1.f, box, occupancy_resolution, n_threads);
+	}
+	else {
+		m_occupancy = OccupancyGrid();
 	}
+}
 
-	t = t1 > eps_ray_sep ? t1 : t2;
+Box3 ImplicitSurface::unrefined_bounds() const
+{
+	return intersection(bounding_box, field->superlevel_bounds(1.f));
+}
+
+FieldLevel ImplicitSurface::level_field() const
+{
+	return FieldLevel(*field, 1.f, m_program.compiled_from(field.get()) ? &m_program : nullptr);
+}
+
+Vec3 ImplicitSurface::normal_at(const Ray& ray, const FieldLevel& level, float t) const
+{
+	Vec3 n = level.gradient(ray.at(t)) * -1;
+	n.normalize();
+	return n;
+}
+
+Sphere::Sphere(const Vec3& _center, float _radius) :
+	center(_center), radius(_radius)
+{
+}
+
+bool Sphere::hit(const Ray& ray, float& t, Vec3& n) const
+{
+	if (!intersect_sphere(ray.origin, ray.dir, center, radius, t)) {
+		return false;
+	}
 
 	n = (ray.at(t) - center).normalized();
 	return true;
 }
 
+bool Sphere::occluded(const Ray& ray, float t_max) const
+{
+	float t = 0.f;
+	return intersect_sphere(ray.origin, ray.dir, center, radius, t) && t < t_max;
+}
+
+Box3 Sphere::bounds() const
+{
+	return Box3(center - Vec3(radius), center + Vec3(radius));
+}
+
 Plane::Plane(const Vec3& _origin, const Vec3& _normal) :
 	origin(_origin), normal(_normal)
 {
@@ -81,15 +253,7 @@ Plane::Plane(const Vec3& _origin, const Vec3& _normal) :
 
 bool Plane::hit(const Ray& ray, float& t, Vec3& n) const
 {
-	float alpha = normal.dot(origin - ray.origin);
-	float beta = ray.dir.dot(normal);
-
-	if (std::abs(beta) < eps_div_by_zero) {
-		return false;
-	}
-
-	t = alpha / beta;
-	if (t < eps_ray_sep) {
+	if (!intersect_plane(ray.origin, ray.dir, origin, normal, t)) {
 		return false;
 	}
 
@@ -97,6 +261,12 @@ bool Plane::hit(const Ray& ray, float& t, Vec3& n) const
 	return true;
 }
 
+bool Plane::occluded(const Ray& ray, float t_max) const
+{
+	float t = 0.f;
+	return intersect_plane(ray.origin, ray.dir, origin, normal, t) && t < t_max;
+}
+
 Tube::Tube(const Vec3& _origin, const Vec3& _direction, float _radius) : 
 	origin(_origin), direction(_direction), radius(_radius)
 {
@@ -104,24 +274,10 @@ Tube::Tube(const Vec3& _origin, const Vec3& _direction, float _radius) :
 
 bool Tube::hit(const Ray& ray, float& t, Vec3& n) const
 {
-	Vec3 v1 = ray.dir - direction * ray.dir.dot(direction);
-	Vec3 v2 = ray.origin - origin - direction * direction.dot(ray.origin - origin);
-	float a = v1.length2();
-	float b = 2.f * v1.dot(v2);
-	float c = v2.length2() - (radius * radius);
-	float delta = b * b - 4.f * a * c;
-	if (delta < 0) {
+	if (!intersect_tube(ray.origin, ray.dir, origin, direction, radius, t)) {
 		return false;
 	}
 
-	float t1 = (-b - std::sqrt(delta)) / (2.f * a);
-	float t2 = (-b + std::sqrt(delta)) / (2.f * a);
-	if (t1 < eps_ray_sep && t2 < eps_ray_sep) {
-		return false;
-	}
-
-	t = t1 > eps_ray_sep ? t1 : t2;
-
 	Vec3 p = ray.at(t);
 	Vec3 q = origin + direction * direction.dot(p - origin);
 	n = (p - q).normalized();
@@ -129,4 +285,10 @@ bool Tube::hit(const Ray& ray, float& t, Vec3& n) const
 	return true;
 }
 
+bool Tube::occluded(const Ray& ray, float t_max) const
+{
+	float t = 0.f;
+	return intersect_tube(ray.origin, ray.dir, origin, direction, radius, t) && t < t_max;
+}
+
 }